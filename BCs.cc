@@ -1,19 +1,57 @@
 /**
  * @file BCs.cc
- * @brief Definition of BC functions
+ * @brief Definitions of the typed boundary conditions
  */
 
 #include "BCs.h"
 
-double b0(const double o_value)
+/**
+ * @brief Returns a condition prescribing @p value
+ */
+boundary_condition boundary_condition::dirichlet(const double value)
 {
-        return 1.0;
+        boundary_condition bc;
+        bc.type = bc_type::dirichlet;
+        bc.value = value;
+        return bc;
 }
-double b1(const double o_value)
+
+/**
+ * @brief Returns a zero gradient condition
+ */
+boundary_condition boundary_condition::extrapolation()
 {
-        return 2.0;
+        return boundary_condition();
 }
-double b2(const double o_value)
+
+/**
+ * @brief Returns a condition prescribing @p g at the time given to it
+ */
+boundary_condition boundary_condition::time_dependent(
+        const std::function<double(const double)> &g)
 {
-        return o_value;
-}
\ No newline at end of file
+        boundary_condition bc;
+        bc.type = bc_type::time_dependent;
+        bc.time_value = g;
+        return bc;
+}
+
+/**
+ * @brief Returns the prescribed value at @p time
+ * 
+ * Not used for bc_type::extrapolation, where the value is that of the owner side
+ */
+double boundary_condition::value_at(const double time) const
+{
+        return (type == bc_type::time_dependent) ? time_value(time) : value;
+}
+
+/**
+ * @brief Returns the conditions of the problem: values 1 and 2 are prescribed on boundaries 0
+ * and 1, and boundary 2 has zero gradient
+ */
+bc_set default_bcs()
+{
+        return {boundary_condition::dirichlet(1.0), boundary_condition::dirichlet(2.0),
+                boundary_condition::extrapolation()};
+}
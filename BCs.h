@@ -1,20 +1,50 @@
 /**
  * @file BCs.h
- * @brief Declarations for BCs and definition of the BC fn (ptr) array
+ * @brief Declarations of the typed boundary conditions
  * 
- * The boundary functions for each of the boundaries are written and combined into an array of
- * functions (or function pointers). See advection2D::set_boundary_ids() for the boundary
- * definitions. All functions take owner value as parameter
+ * Every boundary id (see advection2D::set_boundary_ids()) has a boundary_condition. The boundary
+ * faces are stored grouped by boundary id, so that the type of the condition is known for a whole
+ * batch of faces and the neighbor side values are set in a tight loop, without a call through a
+ * function object per face dof. See advection2D::compute_boundary_fluxes()
  */
 
 #ifndef BCs_h
 #define BCs_h
 
-#include <functional> // alternate to function pointers
+#include <functional>
 #include <array>
 
-double b0(const double o_value);
-double b1(const double o_value);
-double b2(const double o_value);
+/// Types of boundary_condition
+enum class bc_type
+{
+        dirichlet, ///< constant prescribed value
+        extrapolation, ///< neighbor side value equal to the owner side value (zero gradient)
+        time_dependent ///< prescribed value depending only on time
+};
 
-#endif
\ No newline at end of file
+/**
+ * @brief Boundary condition of a boundary id, giving the neighbor side value of its faces
+ * 
+ * The value of a bc_type::time_dependent condition is evaluated once per operator application,
+ * at the time of the stage. See value_at()
+ */
+struct boundary_condition
+{
+        bc_type type = bc_type::extrapolation;
+        double value = 0; // prescribed value of bc_type::dirichlet
+        std::function<double(const double)> time_value; // value of bc_type::time_dependent
+
+        static boundary_condition dirichlet(const double value);
+        static boundary_condition extrapolation();
+        static boundary_condition time_dependent(const std::function<double(const double)> &g);
+        double value_at(const double time) const;
+};
+
+/// Number of boundary ids, see advection2D::set_boundary_ids()
+constexpr unsigned int n_boundary_ids = 3;
+/// Boundary conditions of every boundary id
+using bc_set = std::array<boundary_condition, n_boundary_ids>;
+
+bc_set default_bcs();
+
+#endif
@@ -6,10 +6,12 @@
 #include "advection2D.h"
 
 /**
- * @brief Constructor with @p order of polynomial approx as arg
+ * @brief Constructor with @p order of polynomial approx, operator storage mode @p op_mode and time
+ * integration scheme @p integrator as args
  * 
  * advection2D::mapping, advection2D::fe and advection2D::fe_face are initialised.
- * advection2D::dof_handler is associated to advection2D::triang.
+ * advection2D::dof_handler is associated to advection2D::triang, which is distributed over
+ * <code>MPI_COMM_WORLD</code> when deal.II has p4est.
  * Based on order, face_first_dof and face_dof_increment containers are set here. See
  * https://www.dealii.org/current/doxygen/deal.II/structGeometryInfo.html and
  * https://www.dealii.org/current/doxygen/deal.II/classFE__DGQ.html for face and dof ordering
@@ -19,346 +21,4400 @@
  * Eg: for order=2, on 1-th face, the first cell dof is 2 and the next dof is obtained after
  * increment of 3
  */
-advection2D::advection2D(const uint order)
-: mapping(), fe(order), fe_face(order), dof_handler(triang),
+advection2D::advection2D(const uint order, const operator_mode op_mode,
+        const time_integrator integrator)
+: op_mode(op_mode), integrator(integrator), kernels(select_kernels(order)),
+        mpi_comm(MPI_COMM_WORLD),
+        #ifdef DEAL_II_WITH_P4EST
+        triang(mpi_comm),
+        #endif
+        mapping(), fe(order), fe_face(order), dof_handler(triang), writer(dof_handler, mpi_comm),
+        sf(order),
         face_first_dof{0, order, 0, (order+1)*order},
         face_dof_increment{order+1, order+1, 1, 1}
+{
+        compute_subface_matrices();
+}
+
+/**
+ * @brief Computes advection2D::subface_interpolation and advection2D::subface_projection
+ * 
+ * Let @f$l_k@f$ be the 1D Lagrange basis of face dofs on @f$[0,1]@f$, taken from
+ * <code>FE_DGQ<1></code> so that it is consistent with the face dof order, and @f$t_i@f$ its
+ * support points. Subface @f$s@f$ of a face is @f$\xi = (t+s)/2, t\in[0,1]@f$ of it. Then
+ * @f[
+ * I^s_{ik} = l_k\left(\frac{t_i+s}{2}\right), \quad
+ * Q^s = \frac{1}{2}[M_1]^{-1}[P^s], \quad
+ * P^s_{ik} = \int_0^1 l_i\left(\frac{t+s}{2}\right) l_k(t)\,dt
+ * @f]
+ * where @f$[M_1]@f$ is the 1D mass matrix and @f$1/2@f$ is the length ratio of a subface. The
+ * integrals are exact with @f$(N+1)@f$ point Gauss quadrature. This assumes straight faces in
+ * standard orientation, as is the case for the meshes generated by setup_system().
+ */
+void advection2D::compute_subface_matrices()
+{
+        const uint n = fe_face.dofs_per_face;
+        const FE_DGQ<1> fe_1d(fe.degree);
+        const QGauss<1> quad(fe.degree+1);
+        const std::vector<Point<1>> &support_points = fe_1d.get_unit_support_points();
+        FullMatrix<double> mass(n), mass_inv(n), coupling(n);
+        uint subface, i, j, k, q;
+        mass = 0;
+        for(i=0; i<n; i++){
+                for(k=0; k<n; k++){
+                        for(q=0; q<quad.size(); q++){
+                                mass(i,k) += fe_1d.shape_value(i, quad.point(q))*
+                                        fe_1d.shape_value(k, quad.point(q))*quad.weight(q);
+                        }
+                }
+        }
+        mass_inv.invert(mass);
+
+        for(subface=0; subface<2; subface++){
+                std::vector<double> &interpolation = subface_interpolation[subface],
+                        &projection = subface_projection[subface];
+                interpolation.resize(n*n);
+                for(i=0; i<n; i++){
+                        const Point<1> p(0.5*(support_points[i](0) + subface));
+                        for(k=0; k<n; k++) interpolation[i*n + k] = fe_1d.shape_value(k, p);
+                }
+                coupling = 0;
+                for(q=0; q<quad.size(); q++){
+                        const Point<1> p(0.5*(quad.point(q)(0) + subface));
+                        for(i=0; i<n; i++){
+                                for(k=0; k<n; k++){
+                                        coupling(i,k) += fe_1d.shape_value(i, p)*
+                                                fe_1d.shape_value(k, quad.point(q))*quad.weight(q);
+                                }
+                        }
+                }
+                projection.assign(n*n, 0.0);
+                for(i=0; i<n; i++){
+                        for(k=0; k<n; k++){
+                                for(j=0; j<n; j++){
+                                        projection[i*n + k] += 0.5*mass_inv(i,j)*coupling(j,k);
+                                }
+                        }
+                }
+        } // loop over subfaces
+}
+
+/**
+ * @brief Destructor, unmaps the operator cache file if mapped
+ */
+advection2D::~advection2D()
+{
+        unmap_operators();
+}
+
+/**
+ * @brief Enables the operator cache in the existing @p directory, an empty string disables it
+ * 
+ * See load_operator_cache()
+ */
+void advection2D::set_operator_cache(const std::string &directory)
+{
+        op_cache_dir = directory;
+}
+
+/**
+ * @brief Sets the advecting wind to @p new_wind
+ * 
+ * What is reused from assembly depends on the declared wind_dependence:
+ * - wind_dependence::steady: the operators and the face geometry cache are used as they are
+ * - wind_dependence::separable: the operators and the cache are assembled with
+ * @f$\vec{v}_0@f$, and the rhs is scaled by @f$a(t)@f$ in apply_operator(). With
+ * @f$a(t) \ge 0@f$ the Rusanov flux scales by @f$a(t)@f$ as well, so this is exact.
+ * - wind_dependence::general: the wind normal products on faces and the quad point coefficients
+ * of operator_mode::sum_factorized are evaluated again at the time of every rhs evaluation (see
+ * update_wind()), and no matrices are stored. The stable time step is recomputed at the start of
+ * every step of time_loop().
+ * 
+ * @pre Must be called before the system is assembled. A general wind needs
+ * operator_mode::sum_factorized and cannot be used with time_integrator::lts_forward_euler
+ */
+void advection2D::set_wind(const wind_field &new_wind)
+{
+        AssertThrow(new_wind.dependence != wind_dependence::separable || new_wind.time_factor,
+                ExcMessage("A separable wind needs a time factor"));
+        AssertThrow(new_wind.dependence != wind_dependence::general || new_wind.velocity,
+                ExcMessage("A general wind needs a velocity"));
+        AssertThrow(new_wind.dependence != wind_dependence::general ||
+                op_mode == operator_mode::sum_factorized,
+                ExcMessage("A general wind needs the matrix free sum factorized operator mode"));
+        AssertThrow(new_wind.dependence != wind_dependence::general ||
+                integrator != time_integrator::lts_forward_euler,
+                ExcMessage("Local time stepping needs a steady or separable wind"));
+        wind_fn = new_wind;
+}
+
+/**
+ * @brief Enables mesh adaptation every @p interval steps of time_loop(), 0 disables it
+ * 
+ * Every adaptation refines the cells with the largest indicators making up @p refine_fraction of
+ * the total indicator and coarsens the cells with the smallest ones making up
+ * @p coarsen_fraction. Cells are kept within the refinement levels @p min_level and
+ * @p max_level. See adapt_mesh()
+ */
+void advection2D::set_adaptivity(const uint interval, const double refine_fraction,
+        const double coarsen_fraction, const uint min_level, const uint max_level)
+{
+        adapt_interval = interval;
+        adapt_refine_fraction = refine_fraction;
+        adapt_coarsen_fraction = coarsen_fraction;
+        adapt_min_level = min_level;
+        adapt_max_level = max_level;
+}
+
+/**
+ * @brief Enables or disables the device backend of time_loop(), see device_operator
+ * 
+ * When enabled, time_loop() uploads the operators, the face connectivity and the solution once
+ * and does all its steps on the device. The solution is copied back only for output, checkpoints
+ * and at the end. See upload_to_device()
+ * 
+ * @pre The program must be built with the cmake option ADVECTION_WITH_CUDA and a device must be
+ * present
+ */
+void advection2D::set_device(const bool enable)
+{
+        AssertThrow(!enable || device_operator::available(),
+                ExcMessage("No CUDA device, or built without ADVECTION_WITH_CUDA"));
+        use_device = enable;
+}
+
+/**
+ * @brief Enables or disables writing the trace of the operator phases at the end of time_loop()
+ * 
+ * The trace is written to @p base_name_trace.json, with @p base_name that of time_loop() and the
+ * rank zero padded to 4 digits appended with more than one MPI process. See instrumentation
+ * 
+ * @pre The program must be built with the cmake option ADVECTION_WITH_INSTRUMENTATION
+ */
+void advection2D::set_trace(const bool enable)
+{
+        AssertThrow(!enable || instrumentation::enabled(),
+                ExcMessage("Built without ADVECTION_WITH_INSTRUMENTATION"));
+        trace = enable;
+}
+
+/**
+ * @brief Sets the order of the locally owned cells, see order_cells()
+ * 
+ * @pre Must be called before setup_system() or load_checkpoint(). A checkpoint can only be loaded
+ * with the ordering it was saved with
+ */
+void advection2D::set_cell_ordering(const cell_ordering new_ordering)
+{
+        ordering = new_ordering;
+}
+
+/**
+ * @brief Enables or disables single precision storage of the stiffness and lifting matrices
+ * 
+ * The matrices are still computed, cached and checkpointed in double. After every assembly, a copy
+ * rounded to float is made by convert_operators() and read by the cell kernels instead. They
+ * convert every entry to double and accumulate in double, and the solution, fluxes and cell rhs
+ * stay in double. So only the operator bytes read per rhs evaluation are halved, which matters
+ * when the matrices do not fit in cache, as in operator_mode::per_cell. The rounding error is
+ * measured by check_float_operators(), which goes back to the double matrices if the relative rhs
+ * error exceeds @p tolerance.
+ * 
+ * There is no effect in operator_mode::sum_factorized, which has no matrices, and on the device
+ * backend (see set_device()), which uploads the double matrices.
+ * 
+ * @pre Must be called before assemble_system() or load_checkpoint()
+ */
+void advection2D::set_float_operators(const bool enable, const double tolerance)
+{
+        float_ops = enable;
+        float_op_tolerance = tolerance;
+}
+
+/**
+ * @brief Enables the in-situ diagnostics of time_loop() every @p interval steps, 0 to disable
+ * 
+ * At these steps and at the last one, the total mass @f$\int\phi@f$, the min and max dof values
+ * and, if @p exact is given, the L2 error @f$\|\phi - \phi_e(\cdot,t)\|@f$ with the exact
+ * solution @f$\phi_e(\vec{x},t)@f$ = @p exact(@f$\vec{x}@f$, @f$t@f$) are logged in a single line
+ * and written to @p base_name_diagnostics.csv, with @p base_name that of time_loop(). The change
+ * of mass since the start of the run, across restarts (see time_loop()), checks conservation, up
+ * to the boundary fluxes.
+ * 
+ * The reductions are fused into the kernels which write the final stage of the step, so that the
+ * solution is not read again: compute_cells() for forward Euler and SSPRK3, add_and_diagnose() for
+ * the last vector update of LSRK45 and compute_lts_cells() for the last fine step of local time
+ * stepping. Every written cell is passed to add_cell_diagnostics(), which integrates with the
+ * Gauss quadrature of assembly. The JxW values and points of the quadrature are cached by
+ * fill_diagnostic_geometry(). On the device backend (see set_device()), the solution is copied
+ * back at these steps and reduced in a separate pass by compute_diagnostics() instead.
+ * 
+ * @p exact is called concurrently from several threads, so it must be thread safe.
+ * 
+ * @pre Must be called before assemble_system() or load_checkpoint()
+ */
+void advection2D::set_diagnostics(const uint interval,
+        const std::function<double(const Point<2>&, const double)> &exact)
+{
+        diag_interval = interval;
+        exact_solution = exact;
+}
+
+/**
+ * @brief Sets up the system
+ * 
+ * 1. Mesh is setup with @p n_refinements global refinements of the unit square and stored in
+ * advection2D::triang
+ * 2. advection2D::dof_handler is linked to advection2D::fe
+ * 3. Boundary ids are set and the face connectivity is built. See build_face_data()
+ * 4. advection2D::g_solution and advection2D::gold_solution sizes are set. This is done in
+ * build_face_data() since ghost entries of solution vectors are known only there
+ * 
+ * Steps 2-4 are done in setup_dofs()
+ */
+void advection2D::setup_system(const uint n_refinements)
+{
+        deallog << "Setting up the system" << std::endl;
+        // initialise the triang variable
+        GridGenerator::hyper_cube(triang);
+        // 2^n_refinements cells in each direction, total length 1m
+        triang.refine_global(n_refinements);
+
+        setup_dofs();
+}
+
+/**
+ * @brief Distributes dofs, sets boundary ids and builds the face data on the current mesh
+ */
+void advection2D::setup_dofs()
+{
+        // set dof_handler
+        dof_handler.distribute_dofs(fe);
+
+        set_boundary_ids();
+        build_face_data();
+}
+
+/**
+ * @brief Permutes the blocks of size @p block_size of @p data, block @p i of the result is block
+ * @p order[i] of the input
+ */
+template <typename T>
+static void permute_blocks(std::vector<T> &data, const std::vector<uint> &order,
+        const uint block_size)
+{
+        const std::vector<T> old_data(data);
+        const uint n_blocks = data.size()/block_size;
+        for(uint b=0; b<n_blocks; b++){
+                for(uint i=0; i<block_size; i++){
+                        data[b*block_size + i] = old_data[order[b]*block_size + i];
+                }
+        }
+}
+
+/**
+ * @brief Returns the index of @p (x,y) along the Morton curve, by interleaving the bits of @p x
+ * and @p y
+ */
+static std::uint64_t morton_index(const uint x, const uint y)
+{
+        std::uint64_t index = 0;
+        for(uint bit=0; bit<32; bit++){
+                index |= (static_cast<std::uint64_t>((x >> bit) & 1u) << 2*bit) |
+                        (static_cast<std::uint64_t>((y >> bit) & 1u) << (2*bit + 1));
+        }
+        return index;
+}
+
+/**
+ * @brief Returns the index of @p (x,y) along the Hilbert curve filling the
+ * @f$2^{n_{bits}} \times 2^{n_{bits}}@f$ grid, with @p x, @p y @f$< 2^{n_{bits}}@f$
+ * 
+ * Every level of the curve picks the quadrant of the point, in the order of the curve, and the
+ * point is then rotated into the frame of the curve in that quadrant.
+ */
+static std::uint64_t hilbert_index(const uint n_bits, uint x, uint y)
+{
+        const uint n = 1u << n_bits;
+        std::uint64_t index = 0;
+        uint rx, ry;
+        for(uint s=n/2; s>0; s/=2){
+                rx = (x & s) > 0;
+                ry = (y & s) > 0;
+                index += static_cast<std::uint64_t>(s)*s*((3*rx) ^ ry);
+                if(ry == 0){
+                        if(rx == 1){
+                                x = n-1 - x;
+                                y = n-1 - y;
+                        }
+                        std::swap(x, y);
+                }
+        } // loop over levels of the curve
+        return index;
+}
+
+/**
+ * @brief Orders advection2D::cells as set by set_cell_ordering()
+ * 
+ * The cell centres are mapped to a @f$2^{16} \times 2^{16}@f$ grid over their bounding box and
+ * the cells are sorted by the index of their grid point along the Morton or Hilbert curve. Cells
+ * close along the curve are close in space, so the neighbors of a cell mostly have nearby indices.
+ * Since the dofs, the faces (see build_face_data()) and the operators (see assemble_system()) all
+ * follow the order of advection2D::cells, the face loops and cell loops of apply_operator() then
+ * access the neighbor side values and fluxes in nearby memory. The order of
+ * <code>active_cell_iterators()</code> instead follows the refinement hierarchy (and the order of
+ * the coarse cells), which jumps across the domain between subtrees.
+ * 
+ * The order only depends on the owned cells, so it is recovered exactly on loading a checkpoint.
+ */
+void advection2D::order_cells()
+{
+        if(ordering == cell_ordering::hierarchy || cells.empty()) return;
+        constexpr uint n_bits = 16;
+        const double n_points = (1u << n_bits) - 1;
+        std::vector<Point<2>> centres(cells.size());
+        Point<2> lower = cells[0]->center(), upper = lower;
+        uint c, d;
+        for(c=0; c<cells.size(); c++){
+                centres[c] = cells[c]->center();
+                for(d=0; d<2; d++){
+                        lower(d) = std::min(lower(d), centres[c](d));
+                        upper(d) = std::max(upper(d), centres[c](d));
+                }
+        }
+        std::vector<std::pair<std::uint64_t, uint>> keys(cells.size()); // curve index and cell
+        std::array<uint, 2> grid_point;
+        for(c=0; c<cells.size(); c++){
+                for(d=0; d<2; d++){
+                        const double extent = upper(d) - lower(d);
+                        grid_point[d] = (extent > 0.0) ?
+                                std::lround(n_points*(centres[c](d) - lower(d))/extent) : 0;
+                }
+                keys[c].first = (ordering == cell_ordering::morton) ?
+                        morton_index(grid_point[0], grid_point[1]) :
+                        hilbert_index(n_bits, grid_point[0], grid_point[1]);
+                keys[c].second = c;
+        }
+        std::sort(keys.begin(), keys.end()); // ties are broken by the hierarchy order
+        std::vector<uint> order(cells.size());
+        for(c=0; c<cells.size(); c++) order[c] = keys[c].second;
+        permute_blocks(cells, order, 1);
+}
+
+/**
+ * @brief Builds the face connectivity and dof index tables used by update()
+ *
+ * The mesh is fixed between adaptations. So neighbor indices, face ids wrt owner and neighbor and
+ * the dof ids of face dofs are computed here instead of being queried from deal.II accessors in
+ * every update. advection2D::faces stores, in order:
+ * 1. Boundary faces, grouped by boundary id
+ * 2. Internal faces between locally owned cells of the same level
+ * 3. Hanging faces between locally owned cells
+ * 4. Faces shared with ghost cells of the same level
+ * 5. Hanging faces with a ghost cell on either side
+ * 6. Coarse side faces of owned cells, see advection2D::face_info
+ * 
+ * The ends of these ranges are advection2D::n_boundary_faces, advection2D::n_internal_faces,
+ * advection2D::n_local_faces, advection2D::n_shared_faces, advection2D::n_flux_faces and the
+ * size of advection2D::faces. See advection2D::face_info for the owner convention.
+ *
+ * The neighbor side face dofs of faces shared with ghost cells, and the face dofs of the ghost side
+ * of hanging faces, are the ghost entries of advection2D::g_solution and
+ * advection2D::gold_solution, which are initialised here. Only these dofs are exchanged in rhs().
+ * All dof ids stored are indices in the local storage of these vectors.
+ *
+ * The owned cells are ordered by order_cells() and the dofs are renumbered cell wise in the order
+ * of advection2D::cells. Since DG dofs are not shared between cells, the owned dofs of cell
+ * @f$c@f$ are then the entries @f$[c\,n_{dofs}, (c+1)n_{dofs})@f$ of the local storage of
+ * solution vectors and no cell dof ids are needed. The locally owned cell iterators
+ * (advection2D::cells) and the index of every cell face in advection2D::faces
+ * (advection2D::cell_faces) are also stored by cell index.
+ *
+ * @pre Boundary ids must be set before calling this function
+ */
+void advection2D::build_face_data()
+{
+        // order and number the locally owned cells
+        cells.clear();
+        for(auto &cell: dof_handler.active_cell_iterators()){
+                if(cell->is_locally_owned()) cells.emplace_back(cell);
+        }
+        order_cells();
+        const uint n_cells = cells.size();
+        std::vector<uint> local_cell_ids(triang.n_active_cells(), numbers::invalid_unsigned_int);
+        for(uint c=0; c<n_cells; c++) local_cell_ids[cells[c]->active_cell_index()] = c;
+        DoFRenumbering::cell_wise(dof_handler, cells);
+        cell_faces.resize(n_cells*GeometryInfo<2>::faces_per_cell);
+
+        // faces and the cells on their owner and neighbor side, lists in the order of
+        // advection2D::faces
+        enum face_list {boundary_list, internal_list, hanging_list, shared_list,
+                shared_hanging_list, coarse_list, n_lists};
+        std::array<std::vector<face_info>, n_lists> face_lists;
+        std::array<std::vector<DoFHandler<2>::active_cell_iterator>, n_lists> owner_cell_lists,
+                neighbor_cell_lists;
+        // list and position in list of the two hanging faces of every coarse side face
+        std::vector<std::array<std::pair<uint, uint>, 2>> coarse_subface_positions;
+        IndexSet ghost_dofs(dof_handler.n_dofs());
+        std::vector<types::global_dof_index> dof_ids(fe.dofs_per_cell);
+        // adds the face dofs of face face_id of a ghost cell to ghost_dofs
+        auto add_ghost_face_dofs = [&](const DoFHandler<2>::active_cell_iterator &ghost_cell,
+                const uint ghost_face_id){
+                ghost_cell->get_dof_indices(dof_ids);
+                for(uint i=0; i<fe_face.dofs_per_face; i++){
+                        ghost_dofs.add_index(dof_ids[face_first_dof[ghost_face_id] +
+                                i*face_dof_increment[ghost_face_id]]);
+                }
+        };
+        uint c, face_id, face_id_neighbor, neighbor, list_id, subface;
+        for(c=0; c<n_cells; c++){
+                const DoFHandler<2>::active_cell_iterator &cell = cells[c];
+                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                        face_info cur_face;
+                        cur_face.owner = c;
+                        cur_face.owner_face_id = face_id;
+                        cur_face.subface = numbers::invalid_unsigned_int;
+                        if(cell->face(face_id)->at_boundary()){
+                                cur_face.neighbor = numbers::invalid_unsigned_int;
+                                cur_face.neighbor_face_id = numbers::invalid_unsigned_int;
+                                cur_face.at_boundary = true;
+                                cur_face.boundary_id = cell->face(face_id)->boundary_id();
+                                face_lists[boundary_list].emplace_back(cur_face);
+                                owner_cell_lists[boundary_list].emplace_back(cell);
+                                neighbor_cell_lists[boundary_list].emplace_back(cell); // not used
+                                continue;
+                        }
+                        cur_face.at_boundary = false;
+                        cur_face.boundary_id = numbers::internal_face_boundary_id;
+
+                        if(cell->face(face_id)->has_children()){
+                                // finer neighbors: the hanging faces and the coarse side face
+                                std::array<std::pair<uint, uint>, 2> subface_positions;
+                                for(subface=0; subface<2; subface++){
+                                        const DoFHandler<2>::active_cell_iterator fine_cell =
+                                                cell->neighbor_child_on_subface(face_id, subface);
+                                        face_info hanging_face = cur_face;
+                                        hanging_face.owner_face_id =
+                                                GeometryInfo<2>::opposite_face[face_id];
+                                        hanging_face.neighbor = c;
+                                        hanging_face.neighbor_face_id = face_id;
+                                        hanging_face.subface = subface;
+                                        const bool fine_owned = fine_cell->is_locally_owned();
+                                        list_id = fine_owned ? hanging_list : shared_hanging_list;
+                                        hanging_face.owner = fine_owned ?
+                                                local_cell_ids[fine_cell->active_cell_index()] :
+                                                numbers::invalid_unsigned_int;
+                                        if(!fine_owned){
+                                                add_ghost_face_dofs(fine_cell,
+                                                        hanging_face.owner_face_id);
+                                        }
+                                        subface_positions[subface] = {list_id,
+                                                face_lists[list_id].size()};
+                                        face_lists[list_id].emplace_back(hanging_face);
+                                        owner_cell_lists[list_id].emplace_back(fine_cell);
+                                        neighbor_cell_lists[list_id].emplace_back(cell);
+                                }
+                                cur_face.neighbor = numbers::invalid_unsigned_int;
+                                cur_face.neighbor_face_id = numbers::invalid_unsigned_int;
+                                coarse_subface_positions.emplace_back(subface_positions);
+                                face_lists[coarse_list].emplace_back(cur_face);
+                                owner_cell_lists[coarse_list].emplace_back(cell);
+                                neighbor_cell_lists[coarse_list].emplace_back(cell); // not used
+                                continue;
+                        }
+
+                        const DoFHandler<2>::active_cell_iterator neighbor_cell = cell->neighbor(face_id);
+                        if(cell->neighbor_is_coarser(face_id)){
+                                // hanging face, added from the coarse side if it is owned
+                                if(neighbor_cell->is_locally_owned()) continue;
+                                const std::pair<uint, uint> coarse_face =
+                                        cell->neighbor_of_coarser_neighbor(face_id);
+                                add_ghost_face_dofs(neighbor_cell, coarse_face.first);
+                                cur_face.neighbor = numbers::invalid_unsigned_int;
+                                cur_face.neighbor_face_id = coarse_face.first;
+                                cur_face.subface = coarse_face.second;
+                                list_id = shared_hanging_list;
+                                face_lists[list_id].emplace_back(cur_face);
+                                owner_cell_lists[list_id].emplace_back(cell);
+                                neighbor_cell_lists[list_id].emplace_back(neighbor_cell);
+                                continue;
+                        }
+
+                        face_id_neighbor = cell->neighbor_of_neighbor(face_id);
+                        if(neighbor_cell->is_locally_owned()){
+                                neighbor = local_cell_ids[neighbor_cell->active_cell_index()];
+                                if(neighbor > c) continue;
+                                list_id = internal_list;
+                                cur_face.neighbor = neighbor;
+                                cur_face.neighbor_face_id = face_id_neighbor;
+                        }
+                        else{
+                                // ghost neighbor, its face dofs are ghost entries
+                                list_id = shared_list;
+                                add_ghost_face_dofs(neighbor_cell, face_id_neighbor);
+                                if(cell->id() < neighbor_cell->id()){
+                                        // ghost cell is the owner
+                                        cur_face.owner = numbers::invalid_unsigned_int;
+                                        cur_face.owner_face_id = face_id_neighbor;
+                                        cur_face.neighbor = c;
+                                        cur_face.neighbor_face_id = face_id;
+                                        face_lists[shared_list].emplace_back(cur_face);
+                                        owner_cell_lists[shared_list].emplace_back(neighbor_cell);
+                                        neighbor_cell_lists[shared_list].emplace_back(cell);
+                                        continue;
+                                }
+                                cur_face.neighbor = numbers::invalid_unsigned_int;
+                                cur_face.neighbor_face_id = face_id_neighbor;
+                        }
+                        face_lists[list_id].emplace_back(cur_face);
+                        owner_cell_lists[list_id].emplace_back(cell);
+                        neighbor_cell_lists[list_id].emplace_back(neighbor_cell);
+                } // loop over faces
+        } // loop over cells
+
+        // classify the boundary faces by boundary id, so that every boundary condition is applied
+        // to contiguous batches, see compute_boundary_fluxes()
+        std::vector<uint> boundary_order(face_lists[boundary_list].size());
+        std::iota(boundary_order.begin(), boundary_order.end(), 0u);
+        std::stable_sort(boundary_order.begin(), boundary_order.end(),
+                [&face_lists](const uint a, const uint b){
+                        return face_lists[boundary_list][a].boundary_id <
+                                face_lists[boundary_list][b].boundary_id;
+                }
+        );
+        permute_blocks(face_lists[boundary_list], boundary_order, 1);
+        permute_blocks(owner_cell_lists[boundary_list], boundary_order, 1);
+        permute_blocks(neighbor_cell_lists[boundary_list], boundary_order, 1);
+
+        faces.clear();
+        face_owner_cells.clear();
+        std::vector<DoFHandler<2>::active_cell_iterator> face_neighbor_cells;
+        std::array<uint, n_lists> list_offsets;
+        for(list_id=0; list_id<n_lists; list_id++){
+                list_offsets[list_id] = faces.size();
+                faces.insert(faces.end(), face_lists[list_id].begin(), face_lists[list_id].end());
+                face_owner_cells.insert(face_owner_cells.end(), owner_cell_lists[list_id].begin(),
+                        owner_cell_lists[list_id].end());
+                face_neighbor_cells.insert(face_neighbor_cells.end(),
+                        neighbor_cell_lists[list_id].begin(), neighbor_cell_lists[list_id].end());
+        }
+        n_boundary_faces = list_offsets[internal_list];
+        n_internal_faces = list_offsets[hanging_list];
+        n_local_faces = list_offsets[shared_list];
+        n_shared_faces = list_offsets[shared_hanging_list];
+        n_flux_faces = list_offsets[coarse_list];
+        coarse_subfaces.resize(coarse_subface_positions.size());
+        for(c=0; c<coarse_subfaces.size(); c++){
+                for(subface=0; subface<2; subface++){
+                        const std::pair<uint, uint> &pos = coarse_subface_positions[c][subface];
+                        coarse_subfaces[c][subface] = list_offsets[pos.first] + pos.second;
+                }
+        }
+        face_fluxes.resize(faces.size()*fe_face.dofs_per_face);
+
+        for(uint f=0; f<faces.size(); f++){
+                if(faces[f].owner != numbers::invalid_unsigned_int){
+                        cell_faces[faces[f].owner*GeometryInfo<2>::faces_per_cell +
+                                faces[f].owner_face_id] = f;
+                }
+                // the coarse cell of a hanging face uses its coarse side face instead
+                if(faces[f].neighbor != numbers::invalid_unsigned_int &&
+                        faces[f].subface == numbers::invalid_unsigned_int){
+                        cell_faces[faces[f].neighbor*GeometryInfo<2>::faces_per_cell +
+                                faces[f].neighbor_face_id] = f;
+                }
+        }
+
+        // no system_matrix because the solution is updated cell wise
+        ghost_dofs.compress();
+        g_solution.reinit(dof_handler.locally_owned_dofs(), ghost_dofs, mpi_comm);
+        gold_solution.reinit(g_solution);
+        const Utilities::MPI::Partitioner &partitioner = *g_solution.get_partitioner();
+
+        #ifdef DEBUG
+        for(c=0; c<n_cells; c++){
+                cells[c]->get_dof_indices(dof_ids);
+                for(uint i=0; i<fe.dofs_per_cell; i++){
+                        Assert(partitioner.global_to_local(dof_ids[i]) == c*fe.dofs_per_cell + i,
+                                ExcMessage("Dofs are not numbered cell wise"));
+                }
+        }
+        #endif
+
+        // face dof ids, mapped from cell dof ids
+        face_dof_ids.assign(faces.size()*fe_face.dofs_per_face, numbers::invalid_unsigned_int);
+        face_dof_ids_neighbor.assign(faces.size()*fe_face.dofs_per_face,
+                numbers::invalid_unsigned_int);
+        for(uint f=0; f<faces.size(); f++){
+                const face_info &cur_face = faces[f];
+                face_owner_cells[f]->get_dof_indices(dof_ids);
+                for(uint i=0; i<fe_face.dofs_per_face; i++){
+                        face_dof_ids[f*fe_face.dofs_per_face + i] = partitioner.global_to_local(
+                                dof_ids[face_first_dof[cur_face.owner_face_id] +
+                                i*face_dof_increment[cur_face.owner_face_id]]
+                        );
+                }
+                if(cur_face.at_boundary || f >= n_flux_faces) continue;
+                // for a hanging face, these are the face dofs of the coarse cell
+                face_neighbor_cells[f]->get_dof_indices(dof_ids);
+                for(uint i=0; i<fe_face.dofs_per_face; i++){
+                        face_dof_ids_neighbor[f*fe_face.dofs_per_face + i] =
+                                partitioner.global_to_local(
+                                        dof_ids[face_first_dof[cur_face.neighbor_face_id] +
+                                        i*face_dof_increment[cur_face.neighbor_face_id]]
+                                );
+                }
+        } // loop over faces
+        deallog << "Face data built: " <<
+                Utilities::MPI::sum(n_boundary_faces, mpi_comm) << " boundary, " <<
+                Utilities::MPI::sum(n_internal_faces - n_boundary_faces, mpi_comm) <<
+                " internal, " <<
+                Utilities::MPI::sum(n_shared_faces - n_local_faces, mpi_comm) <<
+                " inter-process and " <<
+                Utilities::MPI::sum((n_local_faces - n_internal_faces) +
+                        (n_flux_faces - n_shared_faces), mpi_comm) <<
+                " hanging faces" << std::endl;
+}
+
+/**
+ * @brief Assembles the system
+ * 
+ * For every cell, the stiffness and lifting matrices are computed by assemble_cell_operators().
+ * With advection2D::op_mode set to operator_mode::shared, cells which are similar (see
+ * operator_key()) share a single set of stiffness and lifting matrices. For a cell with size
+ * @f$h@f$ similar to the cell with size @f$h_r@f$ for which the shared matrices were computed,
+ * both the stiffness and lifting matrices are @f$h_r/h@f$ times the shared ones, because the mass
+ * matrix scales as @f$h^2@f$ and differentiation and flux matrices as @f$h@f$. This factor is
+ * stored in advection2D::cell_op_scales and the matrix set id in advection2D::cell_op_ids. Cells
+ * which are not affine in shared mode, and all cells in operator_mode::per_cell, get their own
+ * matrices with scale 1. In operator_mode::sum_factorized, no matrices are stored, see
+ * assemble_sum_factorized().
+ * 
+ * The face geometry cache and stable time step are also computed here, see
+ * assemble_face_geometry(). Unless the wind is general, update() uses these values directly, see
+ * set_wind().
+ * 
+ * The matrices are stored in advection2D::op_storage, one block per operator id (see
+ * op_block_size()). If set_operator_cache() was called, the operators are mapped from the cache
+ * file instead when it matches, and saved to it after assembly otherwise. See
+ * load_operator_cache(). In either case, they are rounded to single precision at the end if
+ * enabled by set_float_operators().
+ * 
+ * The matrices are computed by assemble_new_operators(). After mesh adaptation,
+ * reassemble_system() is used instead, which computes the matrices of changed cells only.
+ *
+ * @pre build_face_data() must be called before this function
+ */
+void advection2D::assemble_system()
+{
+        deallog << "Assembling system ... " << std::flush;
+        assemble_face_geometry();
+
+        unmap_operators();
+        op_storage.clear();
+        n_ops = 0;
+        op_data = nullptr;
+        op_keys.clear();
+        cell_op_ids.assign(cells.size(), numbers::invalid_unsigned_int);
+        cell_op_scales.assign(cells.size(), 1.0);
+
+        if(op_mode == operator_mode::sum_factorized){
+                assemble_sum_factorized();
+                deallog << "Completed assembly, using sum factorization" << std::endl;
+                return;
+        }
+        if(!op_cache_dir.empty() && load_operator_cache()){
+                convert_operators();
+                deallog << "Completed assembly, " << n_ops << " operator set(s) mapped from cache" <<
+                        std::endl;
+                return;
+        }
+
+        assemble_new_operators();
+        if(!op_cache_dir.empty()) save_operator_cache();
+        convert_operators();
+        deallog << "Completed assembly, " << n_ops << " operator set(s) stored for " <<
+                cells.size() << " cells" << std::endl;
+}
+
+/**
+ * @brief Assigns operator ids to the cells whose advection2D::cell_op_ids is invalid and computes
+ * the matrices of new operator sets
+ * 
+ * Cells are matched with existing sets through advection2D::op_keys, so a new set is computed
+ * only for a key not seen before. The new sets are appended to advection2D::op_storage.
+ * 
+ * Since the mass matrix is block diagonal, cells are independent and assembly is done in parallel
+ * with <code>WorkStream::run()</code> in two passes:
+ * 1. For every cell, the operator key is computed. The (serial) copier assigns operator ids, so
+ * that the first cell of every key computes the matrices
+ * 2. The matrices are computed for these cells only
+ * 
+ * Every thread has its own advection2D::assembly_scratch.
+ * 
+ * @pre advection2D::op_data must point to advection2D::op_storage, holding advection2D::n_ops
+ * sets
+ */
+void advection2D::assemble_new_operators()
+{
+        std::vector<uint> new_cells; // cells without operators
+        for(uint c=0; c<cells.size(); c++){
+                if(cell_op_ids[c] == numbers::invalid_unsigned_int) new_cells.emplace_back(c);
+        }
+        const assembly_scratch sample_scratch(fe);
+        std::vector<uint> op_cells; // cells computing matrix sets, the first is for set n_ops
+
+        // pass 1: operator ids
+        WorkStream::run(new_cells.begin(), new_cells.end(),
+                [this](const std::vector<uint>::iterator &it, assembly_scratch &scratch,
+                        assembly_key &key_data){
+                        const DoFHandler<2>::active_cell_iterator &cell = cells[*it];
+                        key_data.c = *it;
+                        key_data.size = 1;
+                        key_data.affine = false;
+                        if(op_mode == operator_mode::shared){
+                                scratch.fe_values.reinit(cell);
+                                key_data.affine = operator_key(cell,
+                                        scratch.fe_values.get_quadrature_points(), key_data.key,
+                                        key_data.size);
+                        }
+                },
+                [this, &op_cells](const assembly_key &key_data){
+                        const uint op_id = n_ops + op_cells.size();
+                        if(key_data.affine){
+                                auto it = op_keys.find(key_data.key);
+                                if(it != op_keys.end()){
+                                        // similar cell already assigned
+                                        cell_op_ids[key_data.c] = it->second.first;
+                                        cell_op_scales[key_data.c] =
+                                                it->second.second/key_data.size;
+                                        return;
+                                }
+                                op_keys[key_data.key] = {op_id, key_data.size};
+                        }
+                        cell_op_ids[key_data.c] = op_id;
+                        cell_op_scales[key_data.c] = 1;
+                        op_cells.emplace_back(key_data.c);
+                },
+                sample_scratch,
+                assembly_key()
+        );
+
+        // pass 2: matrices, every new operator id is written by exactly one cell
+        n_ops += op_cells.size();
+        op_storage.resize(std::size_t(n_ops)*op_block_size());
+        op_data = op_storage.data();
+        WorkStream::run(op_cells.begin(), op_cells.end(),
+                [this](const std::vector<uint>::iterator &it, assembly_scratch &scratch,
+                        assembly_key &){
+                        const uint op_id = cell_op_ids[*it], n_sq = fe.dofs_per_cell*fe.dofs_per_cell;
+                        assemble_cell_operators(cells[*it], scratch, scratch.stiff_mat,
+                                scratch.lift_mat);
+                        double *block = op_storage.data() + std::size_t(op_id)*op_block_size();
+                        std::copy(&scratch.stiff_mat(0,0), &scratch.stiff_mat(0,0) + n_sq, block);
+                        for(uint i=0; i<GeometryInfo<2>::faces_per_cell; i++){
+                                std::copy(&scratch.lift_mat[i](0,0), &scratch.lift_mat[i](0,0) + n_sq,
+                                        block + (i+1)*n_sq);
+                        }
+                },
+                [](const assembly_key &){},
+                sample_scratch,
+                assembly_key()
+        );
+}
+
+/**
+ * @brief Assembles the system after mesh adaptation, reusing the operators of unchanged cells
+ * 
+ * @p old_cells has, for every cell, its index on the mesh before adaptation, or invalid if it is
+ * a new cell or was owned by another process. Unchanged cells keep their operator sets and scales,
+ * and the sets not used by any of them are dropped. Then only the new cells are assembled by
+ * assemble_new_operators(), sharing sets with unchanged cells where possible. In
+ * operator_mode::sum_factorized, there are no matrices and the cell data is recomputed for all
+ * cells, which costs about as much as copying it. The face geometry is always recomputed, see
+ * assemble_face_geometry().
+ * 
+ * @pre advection2D::cell_op_ids, advection2D::cell_op_scales and advection2D::op_data must be of
+ * the mesh before adaptation and the face data must be built on the new mesh
+ */
+void advection2D::reassemble_system(const std::vector<uint> &old_cells)
+{
+        if(op_mode == operator_mode::sum_factorized){
+                assemble_system();
+                return;
+        }
+        deallog << "Reassembling system ... " << std::flush;
+        assemble_face_geometry();
+
+        // keep the sets of unchanged cells, numbered in the order of first use
+        const std::vector<uint> old_op_ids(std::move(cell_op_ids));
+        const std::vector<double> old_op_scales(std::move(cell_op_scales));
+        const uint n_old_ops = n_ops;
+        std::vector<uint> new_op_ids(n_old_ops, numbers::invalid_unsigned_int);
+        std::vector<uint> kept_ops; // old id of every kept set
+        cell_op_ids.assign(cells.size(), numbers::invalid_unsigned_int);
+        cell_op_scales.assign(cells.size(), 1.0);
+        uint c, n_unchanged = 0;
+        for(c=0; c<cells.size(); c++){
+                if(old_cells[c] == numbers::invalid_unsigned_int) continue;
+                const uint old_id = old_op_ids[old_cells[c]];
+                if(new_op_ids[old_id] == numbers::invalid_unsigned_int){
+                        new_op_ids[old_id] = kept_ops.size();
+                        kept_ops.emplace_back(old_id);
+                }
+                cell_op_ids[c] = new_op_ids[old_id];
+                cell_op_scales[c] = old_op_scales[old_cells[c]];
+                n_unchanged++;
+        }
+        for(auto it=op_keys.begin(); it!=op_keys.end(); ){
+                if(new_op_ids[it->second.first] == numbers::invalid_unsigned_int){
+                        it = op_keys.erase(it);
+                        continue;
+                }
+                it->second.first = new_op_ids[it->second.first];
+                ++it;
+        }
+
+        AlignedVector<double> kept_storage(std::size_t(kept_ops.size())*op_block_size());
+        for(uint op_id=0; op_id<kept_ops.size(); op_id++){
+                std::copy(op_data + std::size_t(kept_ops[op_id])*op_block_size(),
+                        op_data + std::size_t(kept_ops[op_id] + 1)*op_block_size(),
+                        kept_storage.begin() + std::size_t(op_id)*op_block_size());
+        }
+        unmap_operators();
+        op_storage.swap(kept_storage);
+        op_data = op_storage.data();
+        n_ops = kept_ops.size();
+
+        assemble_new_operators();
+        if(!op_cache_dir.empty()) save_operator_cache();
+        convert_operators();
+        deallog << "Completed assembly, " << n_ops << " operator set(s) stored for " <<
+                cells.size() << " cells, " << cells.size() - n_unchanged << " cells assembled" <<
+                std::endl;
+}
+
+/**
+ * @brief Returns the number of values in an operator set: @f$5n^2@f$ for the stiffness and 4
+ * lifting matrices, with @f$n@f$ dofs per cell
+ */
+uint advection2D::op_block_size() const
+{
+        return (1 + GeometryInfo<2>::faces_per_cell)*fe.dofs_per_cell*fe.dofs_per_cell;
+}
+
+/**
+ * @brief Writes the raw bytes of @p n values starting at @p data to @p ofile
+ */
+template <typename T>
+static void write_raw(std::ofstream &ofile, const T *data, const std::size_t n)
+{
+        ofile.write(reinterpret_cast<const char*>(data), n*sizeof(T));
+}
+
+/**
+ * @brief Reads @p n values into @p data from @p ifile, written by write_raw()
+ */
+template <typename T>
+static void read_raw(std::ifstream &ifile, T *data, const std::size_t n)
+{
+        ifile.read(reinterpret_cast<char*>(data), n*sizeof(T));
+        AssertThrow(ifile, ExcMessage("Checkpoint file is truncated"));
+}
+
+/**
+ * @brief Adds the bytes of @p n values starting at @p data to the 64 bit FNV-1a hash @p hash
+ */
+template <typename T>
+static void hash_bytes(std::uint64_t &hash, const T *data, const std::size_t n)
+{
+        const unsigned char *bytes = reinterpret_cast<const unsigned char*>(data);
+        for(std::size_t i=0; i<n*sizeof(T); i++){
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+        }
+}
+
+/**
+ * @brief Returns the hash identifying the operators of this process
+ * 
+ * The hash covers the degree, operator mode, the vertices of owned cells in their local order and
+ * the wind sampled at the vertices and centres of owned cells and at the face dofs (through
+ * advection2D::face_wind_normal). So any change in mesh, partition, degree or wind changes the
+ * hash.
+ * 
+ * @pre assemble_face_geometry() must be called before this function
+ */
+std::uint64_t advection2D::operator_cache_hash() const
+{
+        std::uint64_t hash = 14695981039346656037ull;
+        const std::array<uint, 3> settings = {fe.degree, static_cast<uint>(op_mode),
+                static_cast<uint>(cells.size())};
+        hash_bytes(hash, settings.data(), settings.size());
+        std::array<double, 4> values;
+        for(const auto &cell: cells){
+                for(uint v=0; v<=GeometryInfo<2>::vertices_per_cell; v++){
+                        const Point<2> p = (v == GeometryInfo<2>::vertices_per_cell) ? cell->center() :
+                                cell->vertex(v);
+                        const Tensor<1,2> cur_wind = assembled_wind(p);
+                        values = {p[0], p[1], cur_wind[0], cur_wind[1]};
+                        hash_bytes(hash, values.data(), values.size());
+                }
+        }
+        hash_bytes(hash, face_wind_normal.data(), face_wind_normal.size());
+        return hash;
+}
+
+/**
+ * @brief Returns the operator cache file name of this process
+ * 
+ * The name has the hash (see operator_cache_hash()) and the process rank, so that different
+ * meshes, degrees and winds can be cached in the same directory.
+ */
+std::string advection2D::operator_cache_filename() const
+{
+        std::ostringstream name;
+        name << op_cache_dir << "/operators_" << std::hex << std::setw(16) << std::setfill('0') <<
+                operator_cache_hash() << std::dec << "." <<
+                Utilities::int_to_string(Utilities::MPI::this_mpi_process(mpi_comm), 4) << ".bin";
+        return name.str();
+}
+
+// first entries of an operator cache file, see load_operator_cache()
+static const std::uint64_t op_cache_magic = 0x31534f5056444141ull, op_cache_version = 2;
+static const uint op_cache_header_size = 9, op_cache_alignment = 64;
+
+/**
+ * @brief Returns the offset of the end of the cell and key data in an operator cache file of
+ * @p n_cells cells and @p n_keys operator keys of @p key_length entries, see load_operator_cache()
+ */
+static std::size_t op_cache_cells_end(const std::size_t n_cells, const std::size_t n_keys,
+        const std::size_t key_length)
+{
+        return op_cache_header_size*sizeof(std::uint64_t) +
+                n_cells*(sizeof(uint) + sizeof(double)) +
+                n_keys*(key_length*sizeof(long long) + sizeof(uint) + sizeof(double));
+}
+
+/**
+ * @brief Maps the operators from the cache file, returns false if there is no matching file
+ * 
+ * The file starts with a header of 9 64 bit integers: magic number, version, hash, degree,
+ * operator mode, number of cells, number of operator sets, the offset of the operator data and
+ * the number of operator keys. These are followed by advection2D::cell_op_ids and
+ * advection2D::cell_op_scales, then by the entries of advection2D::op_keys as the arrays of keys,
+ * their operator ids and their sizes, all of which are copied. The keys are needed to match the
+ * new cells of a later reassemble_system() against the loaded sets, in operator_mode::shared.
+ * Last comes the operator data at a 64 byte aligned offset, which is used directly from the
+ * mapped file through advection2D::op_data. So there is no parsing or assembly. The mapping is
+ * read only and private, and is released by unmap_operators().
+ * 
+ * A file is used only if its header matches, its regions fit in it without overlapping and every
+ * cell and key refers to a stored set, so that a corrupted file is never read out of bounds. Every
+ * process checks its own file, the operators are used only if all processes find theirs.
+ */
+bool advection2D::load_operator_cache()
+{
+        const std::string filename = operator_cache_filename();
+        const std::uint64_t hash = operator_cache_hash();
+        const std::size_t n_cells = cells.size();
+        // operator_key(): the 2 edge vectors and the wind at the quad points
+        const std::size_t key_length = 4 + 2*fe.dofs_per_cell;
+        bool found = false;
+        void *map = MAP_FAILED;
+        std::size_t map_size = 0;
+        const int fd = open(filename.c_str(), O_RDONLY);
+        struct stat file_stat;
+        if(fd >= 0 && fstat(fd, &file_stat) == 0 &&
+                static_cast<std::size_t>(file_stat.st_size) >= op_cache_header_size*sizeof(std::uint64_t)){
+                map_size = file_stat.st_size;
+                map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        if(fd >= 0) close(fd); // the mapping stays valid
+        const std::size_t ids_offset = op_cache_header_size*sizeof(std::uint64_t);
+        if(map != MAP_FAILED){
+                const std::uint64_t *header = static_cast<const std::uint64_t*>(map);
+                const std::size_t set_bytes = std::size_t(op_block_size())*sizeof(double);
+                // the cell and key data must fit before the operator data, which must fit in the
+                // file
+                found = header[0] == op_cache_magic && header[1] == op_cache_version &&
+                        header[2] == hash && header[3] == fe.degree &&
+                        header[4] == static_cast<std::uint64_t>(op_mode) && header[5] == n_cells &&
+                        header[7]%op_cache_alignment == 0 && header[7] <= map_size &&
+                        header[8] <= map_size/(key_length*sizeof(long long)) &&
+                        header[7] >= op_cache_cells_end(n_cells, header[8], key_length) &&
+                        header[6] <= (map_size - header[7])/set_bytes;
+                // every cell and key must refer to a stored set
+                const char *bytes = static_cast<const char*>(map);
+                const std::size_t key_ids_offset = op_cache_cells_end(n_cells, header[8],
+                        key_length) - header[8]*(sizeof(uint) + sizeof(double));
+                uint op_id;
+                for(std::size_t c=0; found && c<n_cells; c++){
+                        std::memcpy(&op_id, bytes + ids_offset + c*sizeof(uint), sizeof(uint));
+                        found = op_id < header[6];
+                }
+                for(std::size_t k=0; found && k<header[8]; k++){
+                        std::memcpy(&op_id, bytes + key_ids_offset + k*sizeof(uint), sizeof(uint));
+                        found = op_id < header[6];
+                }
+        }
+        found = Utilities::MPI::min(static_cast<uint>(found), mpi_comm);
+        if(!found){
+                if(map != MAP_FAILED) munmap(map, map_size);
+                return false;
+        }
+
+        const char *bytes = static_cast<const char*>(map);
+        const std::uint64_t *header = static_cast<const std::uint64_t*>(map);
+        std::size_t offset = ids_offset;
+        std::memcpy(cell_op_ids.data(), bytes + offset, n_cells*sizeof(uint));
+        offset += n_cells*sizeof(uint);
+        std::memcpy(cell_op_scales.data(), bytes + offset, n_cells*sizeof(double));
+        offset += n_cells*sizeof(double);
+        const std::size_t n_keys = header[8];
+        std::vector<long long> key(key_length);
+        uint op_id;
+        double size;
+        for(std::size_t k=0; k<n_keys; k++){
+                std::memcpy(key.data(), bytes + offset + k*key_length*sizeof(long long),
+                        key_length*sizeof(long long));
+                std::memcpy(&op_id, bytes + offset + n_keys*key_length*sizeof(long long) +
+                        k*sizeof(uint), sizeof(uint));
+                std::memcpy(&size, bytes + offset + n_keys*(key_length*sizeof(long long) +
+                        sizeof(uint)) + k*sizeof(double), sizeof(double));
+                op_keys[key] = {op_id, size};
+        }
+        n_ops = header[6];
+        op_data = reinterpret_cast<const double*>(bytes + header[7]);
+        op_map = map;
+        op_map_size = map_size;
+        return true;
+}
+
+/**
+ * @brief Saves the assembled operators to the cache file, see load_operator_cache()
+ * 
+ * The file is written under a temporary name and then renamed, so that a concurrent run never maps
+ * a partially written file.
+ */
+void advection2D::save_operator_cache() const
+{
+        const std::string filename = operator_cache_filename();
+        const std::string tmp_filename = filename + ".tmp";
+        const std::size_t n_cells = cells.size(), n_keys = op_keys.size();
+        const std::size_t key_length = 4 + 2*fe.dofs_per_cell; // see load_operator_cache()
+        const std::size_t cells_end = op_cache_cells_end(n_cells, n_keys, key_length);
+        const std::size_t data_offset = (cells_end + op_cache_alignment - 1)/op_cache_alignment*
+                op_cache_alignment;
+        const std::array<std::uint64_t, op_cache_header_size> header = {op_cache_magic,
+                op_cache_version, operator_cache_hash(), fe.degree,
+                static_cast<std::uint64_t>(op_mode), n_cells, n_ops, data_offset, n_keys};
+        std::vector<long long> keys;
+        std::vector<uint> key_ids;
+        std::vector<double> key_sizes;
+        for(const auto &entry: op_keys){
+                keys.insert(keys.end(), entry.first.begin(), entry.first.end());
+                key_ids.emplace_back(entry.second.first);
+                key_sizes.emplace_back(entry.second.second);
+        }
+        {
+                std::ofstream ofile(tmp_filename, std::ios::binary);
+                write_raw(ofile, header.data(), header.size());
+                write_raw(ofile, cell_op_ids.data(), n_cells);
+                write_raw(ofile, cell_op_scales.data(), n_cells);
+                write_raw(ofile, keys.data(), keys.size());
+                write_raw(ofile, key_ids.data(), key_ids.size());
+                write_raw(ofile, key_sizes.data(), key_sizes.size());
+                const std::vector<char> padding(data_offset - cells_end, 0);
+                write_raw(ofile, padding.data(), padding.size());
+                write_raw(ofile, op_data, std::size_t(n_ops)*op_block_size());
+                if(!ofile){
+                        deallog << "Could not write operator cache " << filename << std::endl;
+                        return;
+                }
+        }
+        std::rename(tmp_filename.c_str(), filename.c_str());
+}
+
+/**
+ * @brief Releases the mapped operator cache file, if any
+ */
+void advection2D::unmap_operators()
+{
+        if(op_map == nullptr) return;
+        munmap(op_map, op_map_size);
+        op_map = nullptr;
+        op_map_size = 0;
+        op_data = nullptr;
+        n_ops = 0;
+}
+
+/**
+ * @brief Rounds the operator sets of advection2D::op_data into advection2D::op_storage_float if
+ * set_float_operators() enabled it, else releases the single precision copy
+ * 
+ * Called whenever advection2D::op_data changes: at the end of assemble_system(),
+ * reassemble_system() and load_checkpoint().
+ */
+void advection2D::convert_operators()
+{
+        op_storage_float.clear();
+        op_data_float = nullptr;
+        if(!float_ops || op_mode == operator_mode::sum_factorized) return;
+        const std::size_t n_values = std::size_t(n_ops)*op_block_size();
+        op_storage_float.resize(n_values);
+        for(std::size_t i=0; i<n_values; i++) op_storage_float[i] = static_cast<float>(op_data[i]);
+        op_data_float = op_storage_float.data();
+}
+
+/**
+ * @brief Checks the single precision operators against the double ones and returns the max norm
+ * of the difference of the two rhs of advection2D::g_solution, relative to that of the double rhs
+ * 
+ * If the error is above the tolerance of set_float_operators(), a message is logged and the
+ * single precision copy is released, so that the double operators are used from then on. Returns
+ * 0 if single precision operators are not in use.
+ * 
+ * @pre advection2D::g_solution must hold a representative solution, e.g. the initial condition
+ */
+double advection2D::check_float_operators()
+{
+        if(op_data_float == nullptr) return 0.0;
+        state float_rhs, double_rhs;
+        float_rhs.reinit(g_solution);
+        double_rhs.reinit(g_solution);
+        rhs(g_solution, float_rhs, cur_time);
+        const float *float_data = op_data_float;
+        op_data_float = nullptr; // the kernels use op_data
+        rhs(g_solution, double_rhs, cur_time);
+        op_data_float = float_data;
+
+        const double rhs_norm = double_rhs.linfty_norm();
+        float_rhs.add(-1.0, double_rhs);
+        const double error = rhs_norm > 0.0 ? float_rhs.linfty_norm()/rhs_norm : 0.0;
+        deallog << "Single precision operators: relative rhs error " << error << std::endl;
+        if(error > float_op_tolerance){
+                deallog << "Error above tolerance " << float_op_tolerance <<
+                        ", using double precision operators" << std::endl;
+                float_ops = false;
+                convert_operators();
+        }
+        return error;
+}
+
+/**
+ * @brief Fills the face geometry cache and computes the stable time step
+ * 
+ * See fill_face_geometry() and compute_cell_time_steps()
+ */
+void advection2D::assemble_face_geometry()
+{
+        face_normals.resize(faces.size()*fe_face.dofs_per_face);
+        face_points.resize(faces.size()*fe_face.dofs_per_face);
+        face_wind_normal.resize(faces.size()*fe_face.dofs_per_face);
+        face_abs_wind_normal.resize(faces.size()*fe_face.dofs_per_face);
+
+        wind_time = cur_time;
+        parallel::apply_to_subranges(0u, static_cast<uint>(faces.size()),
+                [this](const uint begin, const uint end){
+                        fill_face_geometry(begin, end);
+                },
+                64
+        );
+        update_time_steps();
+        if(integrator == time_integrator::lts_forward_euler) setup_local_time_stepping();
+        if(diag_interval > 0) fill_diagnostic_geometry();
+}
+
+/**
+ * @brief Fills advection2D::diag_JxW and, with an exact solution, advection2D::diag_points for
+ * all cells, see set_diagnostics()
+ * 
+ * The quadrature is the @f$(N+1)@f$ point Gauss rule of assembly, whose points are ordered like
+ * those of sum_factorization::interpolate(). Cells are processed in parallel.
+ */
+void advection2D::fill_diagnostic_geometry()
+{
+        const uint n_q = fe.dofs_per_cell;
+        diag_JxW.resize(cells.size()*n_q);
+        if(exact_solution) diag_points.resize(cells.size()*n_q);
+        else diag_points.clear();
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, n_q](const uint begin, const uint end){
+                        FEValues<2> fe_values(mapping, fe, QGauss<2>(fe.degree+1),
+                                update_JxW_values | update_quadrature_points);
+                        uint c, q;
+                        for(c=begin; c<end; c++){
+                                fe_values.reinit(cells[c]);
+                                for(q=0; q<n_q; q++){
+                                        diag_JxW[c*n_q + q] = fe_values.JxW(q);
+                                        if(exact_solution){
+                                                diag_points[c*n_q + q] =
+                                                        fe_values.quadrature_point(q);
+                                        }
+                                }
+                        } // loop over cells
+                },
+                64
+        );
+}
+
+/**
+ * @brief Computes advection2D::cell_time_steps and advection2D::min_time_step from the face
+ * geometry cache
+ */
+void advection2D::update_time_steps()
+{
+        cell_time_steps.resize(cells.size());
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this](const uint begin, const uint end){
+                        compute_cell_time_steps(begin, end);
+                },
+                256
+        );
+        update_stable_time_step();
+}
+
+/**
+ * @brief Constructor, allocates FE values objects and local matrices for @p fe
+ * 
+ * @p fe_values uses @f$(N+1)@f$ point Gauss quadrature and @p fe_face_values its 1D version
+ */
+advection2D::assembly_scratch::assembly_scratch(const FiniteElement<2> &fe)
+: fe_values(fe, QGauss<2>(fe.degree+1),
+        update_values | update_gradients | update_JxW_values | update_quadrature_points),
+fe_face_values(fe, QGauss<1>(fe.degree+1),
+        update_values | update_JxW_values | update_quadrature_points),
+l_mass(fe.dofs_per_cell), l_mass_inv(fe.dofs_per_cell), l_diff(fe.dofs_per_cell)
 {}
 
 /**
- * @brief Sets up the system
+ * @brief Copy constructor, required by <code>WorkStream</code>. New FE values objects are created
+ */
+advection2D::assembly_scratch::assembly_scratch(const assembly_scratch &other)
+: assembly_scratch(other.fe_values.get_fe())
+{}
+
+/**
+ * @brief Computes the data required for operator_mode::sum_factorized
+ * 
+ * For every cell, the coefficients @f$c_x@f$ and @f$c_y@f$ (see sum_factorization) are stored in
+ * advection2D::sf_coeffs, and @f$1/h_x, 1/h_y@f$ in advection2D::sf_inv_sizes. The quad point
+ * locations are obtained directly from the cell extents using the tensor product structure. Cells
+ * are processed in parallel.
+ * 
+ * @pre All cells must be axis aligned rectangles
+ */
+void advection2D::assemble_sum_factorized()
+{
+        const uint n_cells = cells.size(), n_q = sf.n*sf.n;
+        sf_coeffs.resize(2*n_q*n_cells);
+        sf_inv_sizes.resize(2*n_cells);
+        for(uint c=0; c<n_cells; c++){
+                cell_op_ids[c] = numbers::invalid_unsigned_int;
+                cell_op_scales[c] = 1;
+        }
+
+        parallel::apply_to_subranges(0u, n_cells,
+                [this](const uint begin, const uint end){
+                        assemble_sum_factorized(begin, end);
+                },
+                64
+        );
+}
+
+/**
+ * @brief Computes sum factorization data for cells in @p [begin,end)
+ */
+void advection2D::assemble_sum_factorized(const uint begin, const uint end)
+{
+        const uint n = sf.n, n_q = n*n;
+        uint c, q1, q2;
+        for(c=begin; c<end; c++){
+                const DoFHandler<2>::active_cell_iterator &cell = cells[c];
+                const Tensor<1,2> e0 = cell->vertex(1) - cell->vertex(0),
+                        e1 = cell->vertex(2) - cell->vertex(0),
+                        distortion = cell->vertex(3) - cell->vertex(1) - e1;
+                const double h_x = e0[0], h_y = e1[1];
+                AssertThrow(fabs(e0[1]) < 1e-10*h_x && fabs(e1[0]) < 1e-10*h_y &&
+                        distortion.norm() < 1e-10*h_x,
+                        ExcMessage("Sum factorization requires axis aligned rectangular cells"));
+                sf_inv_sizes[2*c] = 1/h_x;
+                sf_inv_sizes[2*c + 1] = 1/h_y;
+
+                for(q2=0; q2<n; q2++){
+                        for(q1=0; q1<n; q1++){
+                                Point<2> loc = cell->vertex(0);
+                                loc(0) += h_x*sf.quad.point(q1)(0);
+                                loc(1) += h_y*sf.quad.point(q2)(0);
+                                const Tensor<1,2> cur_wind = assembled_wind(loc);
+                                const double weight = sf.quad.weight(q1)*sf.quad.weight(q2);
+                                sf_coeffs[2*n_q*c + q1 + n*q2] = cur_wind[0]*weight/h_x;
+                                sf_coeffs[2*n_q*c + n_q + q1 + n*q2] = cur_wind[1]*weight/h_y;
+                        }
+                } // loop over quad points
+        } // loop over cells
+}
+
+/**
+ * @brief Computes the stiffness and the 4 lifting matrices of a cell
+ * 
+ * Calculating mass and differentiation matrices is as usual. Each face will have its own flux
+ * matrix. The containers advection2D::face_first_dof and advection2D::face_dof_increment are used
+ * to map face-local dof index to cell dof index.
+ * 
+ * Shape values (times JxW) and wind dotted shape gradients are first tabulated in the scratch so
+ * that the innermost loops are contiguous sums over quad points. Mass matrix is symmetric, so only
+ * its upper half is computed. A flux matrix is non-zero only in the rows and columns of its face
+ * dofs, so its product with mass inverse is computed using only those.
+ * 
+ * @param[in] cell The cell
+ * @param scratch Scratch data of the thread
+ * @param[out] stiff_mat The stiffness matrix
+ * @param[out] lift_mat The lifting matrices
+ * 
+ * @todo Check whether <code>FEFaceValues::reinit()</code> automatically takes care of direction of
+ * integration for faces 0 and 3 since they are oriented in cw direction.
+ * @remark Probably <code>FEFaceValues::reinit()</code> automatically takes care of direction of a
+ * face because the code was working ok
+ */
+void advection2D::assemble_cell_operators(const DoFHandler<2>::active_cell_iterator &cell,
+        assembly_scratch &scratch,
+        FullMatrix<double> &stiff_mat,
+        std::array<FullMatrix<double>, GeometryInfo<2>::faces_per_cell> &lift_mat) const
+{
+        const uint dofs_per_cell = fe.dofs_per_cell, dofs_per_face = fe_face.dofs_per_face;
+        FEValues<2> &fe_values = scratch.fe_values;
+        FEFaceValues<2> &fe_face_values = scratch.fe_face_values;
+        FullMatrix<double> &l_mass = scratch.l_mass, &l_mass_inv = scratch.l_mass_inv,
+                &l_diff = scratch.l_diff;
+        std::vector<double> &values = scratch.values, &JxW_values = scratch.JxW_values,
+                &wind_grads = scratch.wind_grads;
+
+        uint i, j, i_face, j_face, qid, face_id;
+        double sum;
+        fe_values.reinit(cell);
+        const uint n_q = fe_values.n_quadrature_points;
+        // tabulate, dof index is the slower one
+        values.resize(dofs_per_cell*n_q);
+        JxW_values.resize(dofs_per_cell*n_q);
+        wind_grads.resize(dofs_per_cell*n_q);
+        for(qid=0; qid<n_q; qid++){
+                const Tensor<1,2> cur_wind = assembled_wind(fe_values.quadrature_point(qid));
+                for(i=0; i<dofs_per_cell; i++){
+                        values[i*n_q + qid] = fe_values.shape_value(i, qid);
+                        JxW_values[i*n_q + qid] = fe_values.shape_value(i, qid)*fe_values.JxW(qid);
+                        wind_grads[i*n_q + qid] = fe_values.shape_grad(i, qid)*cur_wind;
+                }
+        } // loop over cell quad points
+
+        // compute mass and diff matrices
+        stiff_mat.reinit(dofs_per_cell, dofs_per_cell);
+        for(i=0; i<dofs_per_cell; i++){
+                for(j=i; j<dofs_per_cell; j++){
+                        sum = 0;
+                        for(qid=0; qid<n_q; qid++) sum += values[i*n_q + qid]*JxW_values[j*n_q + qid];
+                        l_mass(i,j) = sum;
+                        l_mass(j,i) = sum;
+                } // inner loop cell shape fns
+                for(j=0; j<dofs_per_cell; j++){
+                        sum = 0;
+                        for(qid=0; qid<n_q; qid++){
+                                sum += wind_grads[i*n_q + qid]*JxW_values[j*n_q + qid];
+                        }
+                        l_diff(i,j) = sum;
+                } // inner loop cell shape fns
+        } // outer loop cell shape fns
+        l_mass_inv.invert(l_mass);
+        l_mass_inv.mmult(stiff_mat, l_diff); // store mass_inv * diff
+
+        // each face will have a separate flux matrix
+        std::vector<uint> &face_dofs = scratch.face_dofs;
+        std::vector<double> &l_flux = scratch.l_flux; // flux matrix restricted to face dofs
+        face_dofs.resize(dofs_per_face);
+        l_flux.resize(dofs_per_face*dofs_per_face);
+        for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                fe_face_values.reinit(cell, face_id);
+                // mapping
+                for(i_face=0; i_face<dofs_per_face; i_face++){
+                        face_dofs[i_face] = face_first_dof[face_id] +
+                                i_face*face_dof_increment[face_id];
+                }
+                for(i_face=0; i_face<dofs_per_face; i_face++){
+                        for(j_face=0; j_face<dofs_per_face; j_face++){
+                                sum = 0;
+                                for(qid=0; qid<fe_face_values.n_quadrature_points; qid++){
+                                        sum += fe_face_values.shape_value(face_dofs[i_face], qid) *
+                                                fe_face_values.shape_value(face_dofs[j_face], qid) *
+                                                fe_face_values.JxW(qid);
+                                }
+                                l_flux[i_face*dofs_per_face + j_face] = sum;
+                        } // inner loop over face shape fns
+                } // outer loop over face shape fns
+
+                lift_mat[face_id].reinit(dofs_per_cell, dofs_per_cell);
+                for(i=0; i<dofs_per_cell; i++){
+                        for(j_face=0; j_face<dofs_per_face; j_face++){
+                                sum = 0;
+                                for(i_face=0; i_face<dofs_per_face; i_face++){
+                                        sum += l_mass_inv(i, face_dofs[i_face]) *
+                                                l_flux[i_face*dofs_per_face + j_face];
+                                }
+                                lift_mat[face_id](i, face_dofs[j_face]) = sum;
+                        }
+                }
+        }// loop over faces
+
+        // Lifting matrices for faces 0 and 3 must be muliplied by -1 (?)
+        // not sure of this
+        // lift_mat[0] *= -1.0;
+        // lift_mat[3] *= -1.0;
+}
+
+/**
+ * @brief Fills the face geometry cache for faces in @p [begin,end)
+ * 
+ * Normals are obtained on the owner side cell (which may be a ghost cell) from an FEFaceValues
+ * object with Gauss-Lobatto quadrature of order <code>fe.degree+1</code>. The face dof locations
+ * are obtained from an FEValues object with the unit support points of advection2D::fe as
+ * quadrature, and the wind is evaluated there by fill_face_winds().
+ */
+void advection2D::fill_face_geometry(const uint begin, const uint end)
+{
+        FEFaceValues<2> fe_face_values_gl(fe, QGaussLobatto<1>(fe.degree+1), update_normal_vectors);
+        FEValues<2> fe_values_sp(fe, Quadrature<2>(fe.get_unit_support_points()),
+                update_quadrature_points);
+        uint f, i_face, id, face_id;
+        for(f=begin; f<end; f++){
+                face_id = faces[f].owner_face_id;
+                fe_face_values_gl.reinit(face_owner_cells[f], face_id);
+                fe_values_sp.reinit(face_owner_cells[f]);
+                for(i_face=0; i_face<fe_face.dofs_per_face; i_face++){
+                        id = f*fe_face.dofs_per_face + i_face;
+                        face_normals[id] = fe_face_values_gl.normal_vector(i_face);
+                        face_points[id] = fe_values_sp.quadrature_point(
+                                face_first_dof[face_id] + i_face*face_dof_increment[face_id]);
+                } // loop over face dofs
+        } // loop over faces
+        fill_face_winds(begin, end);
+}
+
+/**
+ * @brief Fills advection2D::face_wind_normal and advection2D::face_abs_wind_normal for faces in
+ * @p [begin,end) with assembled_wind() at the cached face dof locations
+ */
+void advection2D::fill_face_winds(const uint begin, const uint end)
+{
+        for(uint id=begin*fe_face.dofs_per_face; id<end*fe_face.dofs_per_face; id++){
+                face_wind_normal[id] = assembled_wind(face_points[id])*face_normals[id];
+                face_abs_wind_normal[id] = fabs(face_wind_normal[id]);
+        }
+}
+
+/**
+ * @brief Returns the wind at @p p used in the stored operators and face geometry cache
+ * 
+ * This is wind_field::shape for a steady or separable wind and the wind at
+ * advection2D::wind_time for a general one
+ */
+Tensor<1,2> advection2D::assembled_wind(const Point<2> &p) const
+{
+        if(wind_fn.dependence == wind_dependence::general) return wind_fn.velocity(p, wind_time);
+        return wind_fn.shape(p);
+}
+
+/**
+ * @brief Returns the factor of the rhs at @p time: @f$a(t)@f$ for a separable wind and 1 otherwise
+ */
+double advection2D::wind_factor(const double time) const
+{
+        if(wind_fn.dependence != wind_dependence::separable) return 1.0;
+        const double factor = wind_fn.time_factor(time);
+        AssertThrow(factor >= 0.0, ExcMessage("The time factor of a separable wind is negative"));
+        return factor;
+}
+
+/**
+ * @brief Evaluates a general wind at @p time in the face geometry cache and the sum factorization
+ * data, if they are not already at that time
+ * 
+ * Only the wind normal products at face dofs and the quad point coefficients of
+ * sum_factorization are recomputed, from the cached face dof locations and the cell extents. So
+ * no FE values are reinitialised. Nothing is done for steady and separable winds.
+ */
+void advection2D::update_wind(const double time)
+{
+        if(wind_fn.dependence != wind_dependence::general || time == wind_time) return;
+        wind_time = time;
+        parallel::apply_to_subranges(0u, static_cast<uint>(faces.size()),
+                [this](const uint begin, const uint end){
+                        fill_face_winds(begin, end);
+                },
+                256
+        );
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this](const uint begin, const uint end){
+                        assemble_sum_factorized(begin, end);
+                },
+                64
+        );
+}
+
+/**
+ * @brief Computes the key used to identify similar cells in operator_mode::shared
+ * 
+ * Two affine cells whose edge vectors are the same up to a positive scaling, and which see the same
+ * wind at corresponding quadrature points, have the same operators up to the scaling done in
+ * assemble_system(). The key consists of the edge vectors of the cell normalised by the length of
+ * its first edge and the wind at @p q_points, all rounded to a relative precision of
+ * @f$10^{-10}@f$.
+ * 
+ * @param[in] cell The cell
+ * @param[in] q_points The cell quadrature points
+ * @param[out] key The key
+ * @param[out] size Length of the first edge of the cell
+ * @return @p true if the cell is affine (a parallelogram) and the key is valid, else @p false
+ */
+bool advection2D::operator_key(const DoFHandler<2>::active_cell_iterator &cell,
+        const std::vector<Point<2>> &q_points, std::vector<long long> &key, double &size) const
+{
+        const double tol = 1e-10;
+        // vertices are ordered lexicographically
+        const Tensor<1,2> e0 = cell->vertex(1) - cell->vertex(0),
+                e1 = cell->vertex(2) - cell->vertex(0),
+                distortion = cell->vertex(3) - cell->vertex(1) - e1;
+        size = e0.norm();
+        if(distortion.norm() > tol*size) return false;
+
+        key.clear();
+        for(uint d=0; d<2; d++){
+                key.emplace_back(std::llround(e0[d]/(size*tol)));
+                key.emplace_back(std::llround(e1[d]/(size*tol)));
+        }
+        for(const Point<2> &p: q_points){
+                const Tensor<1,2> w = assembled_wind(p);
+                key.emplace_back(std::llround(w[0]/tol));
+                key.emplace_back(std::llround(w[1]/tol));
+        }
+        return true;
+}
+
+/**
+ * @brief Sets initial condition
+ * 
+ * Since nodal basis is being used, initial condition is easy to set. interpolate function of
+ * VectorTools namespace is used with IC class and advection2D::g_solution. See IC::value()
+ * 
+ * The time and step counter are reset to 0.
+ */
+void advection2D::set_IC()
+{
+        VectorTools::interpolate(dof_handler, IC(), g_solution);
+        cur_time = 0.0;
+        time_counter = 0;
+}
+
+/**
+ * @brief Sets up the ensemble mode with a member for every initial condition in @p ICs, with the
+ * boundary conditions in @p member_bcs of the same index
+ * 
+ * The members share the mesh, degree, wind and operators, so that a parameter sweep over initial
+ * and boundary conditions needs a single assembly. Their solutions are stored in
+ * advection2D::ensemble_solution with the @f$N@f$ members of a dof contiguous: member @f$m@f$ of
+ * global dof @f$i@f$ is entry @f$iN+m@f$. Since the owned dofs of a process are contiguous, its
+ * owned entries are too, and the ghost entries are the members of the ghost face dofs of
+ * advection2D::g_solution, in the same order. So member @f$m@f$ of a local dof id @f$d@f$ (see
+ * advection2D::face_dof_ids) is at local index @f$dN+m@f$.
+ * 
+ * With this layout, the cell values of all members form a row major @f$n \times N@f$ block, and
+ * the operators are applied to all members at once, see apply_ensemble_operator(). The initial
+ * conditions are interpolated like in set_IC() and the time and step counter are reset to 0.
+ * 
+ * @pre The system must be assembled. Mesh adaptation and local time stepping are not supported in
+ * ensemble mode
+ */
+void advection2D::set_ensemble(const std::vector<std::function<double(const Point<2>&)>> &ICs,
+        const std::vector<bc_set> &member_bcs)
+{
+        AssertThrow(!ICs.empty() && ICs.size() == member_bcs.size(),
+                ExcMessage("Every member needs an initial condition and boundary conditions"));
+        AssertThrow(integrator != time_integrator::lts_forward_euler,
+                ExcMessage("Local time stepping is not supported in ensemble mode"));
+        n_members = ICs.size();
+        ensemble_bcs = member_bcs;
+
+        const uint n_dofs = dof_handler.n_dofs();
+        const IndexSet &owned_dofs = dof_handler.locally_owned_dofs();
+        const IndexSet &ghost_dofs = g_solution.get_partitioner()->ghost_indices();
+        Assert(owned_dofs.is_contiguous(), ExcInternalError());
+        IndexSet owned_entries(n_dofs*n_members), ghost_entries(n_dofs*n_members);
+        if(owned_dofs.n_elements() > 0){
+                const uint first_dof = owned_dofs.nth_index_in_set(0);
+                owned_entries.add_range(first_dof*n_members,
+                        (first_dof + owned_dofs.n_elements())*n_members);
+        }
+        uint i, m;
+        for(i=0; i<ghost_dofs.n_elements(); i++){
+                const uint dof = ghost_dofs.nth_index_in_set(i);
+                ghost_entries.add_range(dof*n_members, (dof + 1)*n_members);
+        }
+        owned_entries.compress();
+        ghost_entries.compress();
+        ensemble_solution.reinit(owned_entries, ghost_entries, mpi_comm);
+        ensemble_old_solution.reinit(ensemble_solution);
+        ensemble_face_fluxes.resize(faces.size()*fe_face.dofs_per_face*n_members);
+        // sized for these members by the first flux pass of every thread
+        ensemble_face_work.clear();
+
+        state member;
+        member.reinit(g_solution);
+        for(m=0; m<n_members; m++){
+                VectorTools::interpolate(dof_handler, ScalarFunctionFromFunctionObject<2>(ICs[m]),
+                        member);
+                for(i=0; i<member.local_size(); i++){
+                        ensemble_solution.local_element(i*n_members + m) = member.local_element(i);
+                }
+        }
+        cur_time = 0.0;
+        time_counter = 0;
+        deallog << "Ensemble of " << n_members << " members set up" << std::endl;
+}
+
+/**
+ * @brief Boundary ids are set here
+ * 
+ * @f$x=0@f$ forms boundary 0 with @f$\phi@f$ value prescribed as @f$1@f$<br/>
+ * @f$y=0@f$ forms boundary 1 with @f$\phi@f$ value prescribed as @f$0@f$<br/>
+ * @f$x=1 \bigcup y=1@f$ forms boundary 2 with zero gradient
+ * @note Ghost cell approach will be used
+ * @note This is called from setup_system() before build_face_data(), which stores the boundary ids
+ * and groups the boundary faces by id. The condition of every id is given by advection2D::bcs
+ * @todo Check this function
+ */
+void advection2D::set_boundary_ids()
+{
+        for(auto &cell: dof_handler.active_cell_iterators()){
+                for(uint face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                        if(cell->face(face_id)->at_boundary()){
+                                Point<2> fcenter = cell->face(face_id)->center(); // face center
+                                if(fabs(fcenter(0)) < 1e-6)
+                                        cell->face(face_id)->set_boundary_id(0);
+                                else if(fabs(fcenter(1)) < 1e-6)
+                                        cell->face(face_id)->set_boundary_id(1);
+                                else
+                                        cell->face(face_id)->set_boundary_id(2);
+                        }
+                } // loop over faces
+        } // loop over cells
+}
+
+/**
+ * @brief Computes the stable time steps of cells in @p [begin,end) at unit Courant number
+ * 
+ * For cell @f$c@f$ with minimum vertex distance @f$h_c@f$,
+ * @f[
+ * \Delta t_c = \frac{h_c}{(2N+1)\max_{\text{face dofs}}|\vec{v}\cdot\vec{n}|}
+ * @f]
+ * where @f$N@f$ is the polynomial degree. The max is over the cached
+ * advection2D::face_abs_wind_normal of the 4 faces of the cell. So these must be filled before
+ * calling this function. Since the values of other cells are not used, only the cells whose wind
+ * changed need to be recomputed, followed by update_stable_time_step().
+ */
+void advection2D::compute_cell_time_steps(const uint begin, const uint end)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        uint c, face_id, f, i;
+        double max_wind;
+        for(c=begin; c<end; c++){
+                max_wind = 0.0;
+                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                        f = cell_faces[c*GeometryInfo<2>::faces_per_cell + face_id];
+                        for(i=0; i<dofs_per_face; i++){
+                                max_wind = std::max(max_wind, face_abs_wind_normal[f*dofs_per_face + i]);
+                        }
+                }
+                if(max_wind == 0.0) cell_time_steps[c] = std::numeric_limits<double>::max();
+                else{
+                        cell_time_steps[c] = cells[c]->minimum_vertex_distance()/
+                                ((2*fe.degree + 1)*max_wind);
+                }
+        } // loop over cells
+}
+
+/**
+ * @brief Sets advection2D::min_time_step as the min of advection2D::cell_time_steps over all
+ * processes
+ */
+void advection2D::update_stable_time_step()
+{
+        double local_min = std::numeric_limits<double>::max();
+        for(const double dt: cell_time_steps) local_min = std::min(local_min, dt);
+        min_time_step = Utilities::MPI::min(local_min, mpi_comm);
+}
+
+/**
+ * @brief Returns the largest stable time step for the Courant number @p courant
+ * 
+ * The value is cached, see compute_cell_time_steps(). For Courant number 1, this is the usual
+ * limit of forward Euler with DG. The SSP schemes of advection2D::time_integrator allow a similar
+ * Courant number per stage. For time_integrator::lts_forward_euler, this is the step of the
+ * slowest level, see setup_local_time_stepping().
+ * 
+ * For a separable wind, the cached value is divided by @f$a(t)@f$ at advection2D::cur_time, unless
+ * it is zero. For a general wind, the cache is recomputed at the start of every step of
+ * time_loop(). In both cases, the limit is that of the wind at the start of the step.
+ */
+double advection2D::stable_time_step(const double courant) const
+{
+        double time_step = courant*min_time_step;
+        if(integrator == time_integrator::lts_forward_euler){
+                time_step *= 1u << (n_time_step_levels - 1);
+        }
+        // the cached time steps are of the shape of a separable wind
+        const double factor = wind_factor(cur_time);
+        if(factor > 0.0) time_step /= factor;
+        return time_step;
+}
+
+/**
+ * @brief Sets up the time step levels of time_integrator::lts_forward_euler on the current mesh
+ * 
+ * Cell @f$K@f$ is given the level
+ * @f[
+ * k_K = \min\left(k_{\max},
+ * \left\lfloor\log_2\frac{\Delta t_K}{\Delta t_{\min}}\right\rfloor\right)
+ * @f]
+ * where @f$\Delta t_K@f$ is its entry in advection2D::cell_time_steps, @f$\Delta t_{\min}@f$ is
+ * advection2D::min_time_step and @f$k_{\max}@f$ is advection2D::max_time_step_level. A cell of
+ * level @f$k@f$ takes steps of @f$2^k@f$ fine steps, which is within its own stability limit. A
+ * face gets the level of its faster side. The levels of ghost cells are obtained through the ghost
+ * entries of their face dofs, so the processes sharing a face agree on its level.
+ * 
+ * The faces in each of the 5 ranges of faces with a flux (boundary, internal, hanging, shared and
+ * shared hanging, see build_face_data()) are then stably sorted by level with permute_faces(). So
+ * the faces up to a level are a prefix of every range, which lets update_lts() use the flux
+ * kernels of apply_operator() on plain ranges. The ends of these prefixes are stored in
+ * advection2D::lts_face_ends. The coarse side faces are not sorted, since their fluxes are
+ * projected on demand, see get_lts_face_flux().
+ * 
+ * @pre The face geometry and the cell time steps must be computed, see assemble_face_geometry()
+ */
+void advection2D::setup_local_time_stepping()
+{
+        const uint n_cells = cells.size();
+        const uint dofs_per_cell = fe.dofs_per_cell, dofs_per_face = fe_face.dofs_per_face;
+        uint c, f, i, r, level, local_max_level = 0;
+        cell_levels.resize(n_cells);
+        for(c=0; c<n_cells; c++){
+                level = 0;
+                while(level < max_time_step_level &&
+                        cell_time_steps[c] >= (2u << level)*min_time_step) level++;
+                cell_levels[c] = level;
+                local_max_level = std::max(local_max_level, level);
+        }
+        n_time_step_levels = Utilities::MPI::max(local_max_level, mpi_comm) + 1;
+
+        // levels of both sides of faces, through the face dofs of owned and ghost cells
+        state level_values;
+        level_values.reinit(g_solution);
+        for(c=0; c<n_cells; c++){
+                for(i=0; i<dofs_per_cell; i++){
+                        level_values.local_element(c*dofs_per_cell + i) = cell_levels[c];
+                }
+        }
+        level_values.update_ghost_values();
+        face_levels.resize(n_flux_faces);
+        face_level_interfaces.resize(n_flux_faces);
+        uint owner_level, neighbor_level;
+        for(f=0; f<n_flux_faces; f++){
+                owner_level = level_values.local_element(face_dof_ids[f*dofs_per_face]);
+                neighbor_level = faces[f].at_boundary ? owner_level :
+                        level_values.local_element(face_dof_ids_neighbor[f*dofs_per_face]);
+                face_levels[f] = std::min(owner_level, neighbor_level);
+                face_level_interfaces[f] = owner_level != neighbor_level;
+        }
+
+        // sort the faces of every range by level, stable so that the boundary faces of a level stay
+        // grouped by boundary id
+        const std::array<uint, 6> range_bounds = {0u, n_boundary_faces, n_internal_faces,
+                n_local_faces, n_shared_faces, n_flux_faces};
+        std::vector<uint> order(faces.size());
+        std::iota(order.begin(), order.end(), 0u);
+        for(r=0; r<5; r++){
+                std::stable_sort(order.begin() + range_bounds[r], order.begin() + range_bounds[r+1],
+                        [this](const uint a, const uint b){
+                                return face_levels[a] < face_levels[b];
+                        }
+                );
+        }
+        permute_blocks(face_levels, order, 1);
+        permute_blocks(face_level_interfaces, order, 1);
+        permute_faces(order);
+
+        lts_face_ends.resize(n_time_step_levels);
+        for(level=0; level<n_time_step_levels; level++){
+                for(r=0; r<5; r++){
+                        lts_face_ends[level][r] = std::upper_bound(
+                                face_levels.begin() + range_bounds[r],
+                                face_levels.begin() + range_bounds[r+1], level) -
+                                face_levels.begin();
+                }
+        }
+        lts_level_cells.assign(n_time_step_levels, std::vector<uint>());
+        for(c=0; c<n_cells; c++) lts_level_cells[cell_levels[c]].emplace_back(c);
+        face_flux_sums.assign(n_flux_faces*dofs_per_face, 0.0);
+
+        // cell updates per macro step, compared to global time stepping with the fine step
+        double n_updates = 0.0;
+        for(c=0; c<n_cells; c++) n_updates += 1u << (n_time_step_levels - 1 - cell_levels[c]);
+        n_updates = Utilities::MPI::sum(n_updates, mpi_comm);
+        const double n_global_updates = static_cast<double>(triang.n_global_active_cells())*
+                (1u << (n_time_step_levels - 1));
+        deallog << "Local time stepping with " << n_time_step_levels << " levels: " <<
+                n_global_updates/n_updates <<
+                " times fewer cell updates than global time stepping" << std::endl;
+}
+
+/**
+ * @brief Reorders the faces with a flux, face @p order[i] becomes face @p i
+ * 
+ * All the face data built by build_face_data() and assemble_face_geometry() is permuted, and
+ * advection2D::cell_faces and advection2D::coarse_subfaces are renumbered. @p order must map
+ * every range of faces (see build_face_data()) onto itself and leave the coarse side faces in
+ * place.
+ */
+void advection2D::permute_faces(const std::vector<uint> &order)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        std::vector<uint> new_ids(order.size());
+        for(uint f=0; f<order.size(); f++) new_ids[order[f]] = f;
+        permute_blocks(faces, order, 1);
+        permute_blocks(face_owner_cells, order, 1);
+        permute_blocks(face_dof_ids, order, dofs_per_face);
+        permute_blocks(face_dof_ids_neighbor, order, dofs_per_face);
+        permute_blocks(face_normals, order, dofs_per_face);
+        permute_blocks(face_points, order, dofs_per_face);
+        permute_blocks(face_wind_normal, order, dofs_per_face);
+        permute_blocks(face_abs_wind_normal, order, dofs_per_face);
+        for(uint &f: cell_faces) f = new_ids[f];
+        for(std::array<uint, 2> &subfaces: coarse_subfaces){
+                for(uint &f: subfaces) f = new_ids[f];
+        }
+}
+
+/**
+ * @brief Advances the solution from advection2D::cur_time to @p end_time with the largest stable
+ * time step for the Courant number @p courant
+ * 
+ * The time step is queried from stable_time_step() in every step, so that changes in it are picked
+ * up. The last step is shortened to end exactly at @p end_time. The loop starts from time 0 after
+ * set_IC() and from the saved time and step after load_checkpoint().
+ * 
+ * The solution is written every @p output_interval steps or, if @p output_time_interval is
+ * positive, at the first step after every multiple of it, and always at the end and at the start
+ * of a fresh run. The step number is the output counter. Writing is done in the background (see
+ * output()) and all the files are complete on return.
+ * 
+ * If @p checkpoint_interval is positive, a checkpoint with operators is saved every
+ * @p checkpoint_interval steps with the base name @p base_name_checkpoint. See save_checkpoint()
+ * 
+ * If enabled by set_adaptivity(), the mesh is adapted after the output and checkpoint of every
+ * advection2D::adapt_interval steps, except the last. See adapt_mesh()
+ * 
+ * If enabled by set_device(), the solution is uploaded after the initial output and stays on the
+ * device until the end, being copied back only for the output and checkpoints.
+ * 
+ * With instrumentation (see instrumentation), the counters of the operator phases are logged
+ * after every step and in all at the end, and the trace is written at the end if enabled by
+ * set_trace().
+ * 
+ * If enabled by set_diagnostics(), the diagnostics are reported at the start and after every
+ * advection2D::diag_interval steps and the last one. On a restart, the rows are appended to the
+ * file and the mass change stays relative to the start of the run, whose mass is restored from the
+ * checkpoint. If the checkpointed run had no diagnostics, it is relative to the restart.
+ */
+void advection2D::time_loop(const double end_time, const double courant,
+        const std::string &base_name, const uint output_interval,
+        const double output_time_interval, const uint checkpoint_interval)
+{
+        double time_step, next_output_time = output_time_interval;
+        if(output_time_interval > 0.0){
+                next_output_time = (std::floor(cur_time/output_time_interval) + 1)*output_time_interval;
+        }
+        bool last_step, write_output;
+        if(time_counter == 0) output(base_name, 0, cur_time); // initial condition
+        std::ofstream diag_file; // opened on the root process only
+        if(diag_interval > 0){
+                if(Utilities::MPI::this_mpi_process(mpi_comm) == 0){
+                        diag_file.open(base_name + "_diagnostics.csv",
+                                time_counter == 0 ? std::ios::out : std::ios::app);
+                        if(time_counter == 0){
+                                diag_file << "step,time,mass,mass_change,min,max,l2_error\n";
+                        }
+                }
+                diag_time = cur_time;
+                compute_diagnostics(g_solution);
+                // a restart keeps the mass of the start of the run, see save_checkpoint()
+                if(time_counter == 0 || std::isnan(diag_initial_mass)){
+                        diag_initial_mass = Utilities::MPI::sum(diag_sums.mass, mpi_comm);
+                }
+                report_diagnostics(diag_file);
+        }
+        if(use_device) upload_to_device();
+        while(cur_time < end_time){
+                if(wind_fn.dependence == wind_dependence::general){
+                        update_wind(cur_time);
+                        update_time_steps();
+                }
+                time_step = stable_time_step(courant);
+                // avoid a tiny last step due to round off
+                last_step = cur_time + time_step*(1.0 + 1e-8) >= end_time;
+                if(last_step) time_step = end_time - cur_time;
+                deallog << "Step " << time_counter << " time " << cur_time << " time step " <<
+                        time_step << std::endl;
+                diagnose_step = diag_interval > 0 &&
+                        ((time_counter + 1)%diag_interval == 0 || last_step);
+                if(diagnose_step){
+                        diag_sums = diagnostics();
+                        diag_time = last_step ? end_time : cur_time + time_step;
+                }
+                update(time_step);
+                INSTRUMENT_END_STEP(time_counter);
+                time_counter++;
+                cur_time = last_step ? end_time : cur_time + time_step;
+                if(diagnose_step){
+                        if(device_resident){
+                                download_from_device();
+                                compute_diagnostics(g_solution);
+                        }
+                        report_diagnostics(diag_file);
+                        diagnose_step = false;
+                }
+                if(output_time_interval > 0.0){
+                        write_output = cur_time >= next_output_time;
+                        while(next_output_time <= cur_time) next_output_time += output_time_interval;
+                }
+                else write_output = output_interval > 0 && time_counter%output_interval == 0;
+                if(write_output || last_step){
+                        output(base_name, time_counter, cur_time);
+                }
+                if(checkpoint_interval > 0 && time_counter%checkpoint_interval == 0){
+                        download_from_device();
+                        save_checkpoint(base_name + "_checkpoint", true);
+                }
+                if(adapt_interval > 0 && time_counter%adapt_interval == 0 && !last_step){
+                        adapt_mesh();
+                }
+        }
+        download_from_device();
+        device_resident = false;
+        if(instrumentation::enabled()) instrumentation::log_summary();
+        if(trace){
+                std::string trace_name = base_name + "_trace";
+                if(Utilities::MPI::n_mpi_processes(mpi_comm) > 1){
+                        trace_name += "." + Utilities::int_to_string(
+                                Utilities::MPI::this_mpi_process(mpi_comm), 4);
+                }
+                instrumentation::write_trace(trace_name + ".json");
+        }
+        writer.flush();
+}
+
+/**
+ * @brief Combines the reductions of @p other into these
+ */
+void advection2D::diagnostics::merge(const diagnostics &other)
+{
+        mass += other.mass;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        error_sq += other.error_sq;
+}
+
+/**
+ * @brief Adds the diagnostics of cell @p cell with dof values @p phi to @p sums
+ * 
+ * The min and max are over the dof values. The values at the Gauss points are obtained with
+ * sum_factorization::interpolate() and integrated with advection2D::diag_JxW for the mass and,
+ * with an exact solution at advection2D::diag_time, for the squared L2 error. For @p degree see
+ * add_lifting()
+ * 
+ * @param work Work array of size @f$2(N+1)^2@f$
+ */
+template <int degree>
+void advection2D::add_cell_diagnostics(const uint cell, const double *phi, double *work,
+        diagnostics &sums) const
+{
+        const uint n_q = (degree > 0) ? (degree+1)*(degree+1) : fe.dofs_per_cell;
+        double *values = work, *temp = work + n_q;
+        const double *JxW = &diag_JxW[cell*n_q];
+        uint q;
+        for(q=0; q<n_q; q++){
+                sums.min = std::min(sums.min, phi[q]);
+                sums.max = std::max(sums.max, phi[q]);
+        }
+        sf.interpolate<(degree > 0) ? degree+1 : 0>(phi, values, temp);
+        for(q=0; q<n_q; q++) sums.mass += JxW[q]*values[q];
+        if(!exact_solution) return;
+        const Point<2> *points = &diag_points[cell*n_q];
+        double diff;
+        for(q=0; q<n_q; q++){
+                diff = values[q] - exact_solution(points[q], diag_time);
+                sums.error_sq += JxW[q]*diff*diff;
+        }
+}
+
+/**
+ * @brief Merges the reductions @p sums of a range of cells into advection2D::diag_sums
+ * 
+ * Called once per range by the threads of the kernels, so the lock is rarely contended.
+ */
+void advection2D::merge_diagnostics(const diagnostics &sums)
+{
+        std::lock_guard<std::mutex> lock(diag_mutex);
+        diag_sums.merge(sums);
+}
+
+/**
+ * @brief Sets advection2D::diag_sums to the diagnostics of @p phi in a separate pass over the
+ * cells
+ * 
+ * Used at the start of time_loop() and on the device backend, where the kernels writing the
+ * final stage do not run on the host. See set_diagnostics()
+ */
+void advection2D::compute_diagnostics(const state &phi)
+{
+        diag_sums = diagnostics();
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, &phi](const uint begin, const uint end){
+                        const uint dofs_per_cell = fe.dofs_per_cell;
+                        AlignedVector<double> &work = cell_work.get();
+                        if(work.size() < 2*dofs_per_cell) work.resize(2*dofs_per_cell);
+                        diagnostics sums;
+                        for(uint c=begin; c<end; c++){
+                                add_cell_diagnostics<-1>(c, phi.begin() + c*dofs_per_cell,
+                                        work.data(), sums);
+                        }
+                        merge_diagnostics(sums);
+                },
+                64
+        );
+}
+
+/**
+ * @brief Computes @p u @f$\mathrel{+}= @f$ @p factor @p v cell by cell and accumulates the
+ * diagnostics of the updated cells into advection2D::diag_sums
+ * 
+ * This is the last vector update of time_integrator::lsrk45 at a diagnosed step, see
+ * set_diagnostics()
+ */
+void advection2D::add_and_diagnose(state &u, const double factor, const state &v)
+{
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, &u, factor, &v](const uint begin, const uint end){
+                        const uint dofs_per_cell = fe.dofs_per_cell;
+                        AlignedVector<double> &work = cell_work.get();
+                        if(work.size() < 2*dofs_per_cell) work.resize(2*dofs_per_cell);
+                        double *u_ptr = u.begin();
+                        const double *v_ptr = v.begin();
+                        diagnostics sums;
+                        uint c, i;
+                        for(c=begin; c<end; c++){
+                                const uint offset = c*dofs_per_cell;
+                                for(i=0; i<dofs_per_cell; i++){
+                                        u_ptr[offset + i] += factor*v_ptr[offset + i];
+                                }
+                                add_cell_diagnostics<-1>(c, u_ptr + offset, work.data(), sums);
+                        } // loop over cells
+                        merge_diagnostics(sums);
+                },
+                64
+        );
+}
+
+/**
+ * @brief Reduces advection2D::diag_sums over all processes and reports them for the current step
+ * 
+ * A line is logged, and the root process writes a row to @p csv. The L2 error is left empty
+ * without an exact solution. See set_diagnostics()
+ */
+void advection2D::report_diagnostics(std::ostream &csv) const
+{
+        const double mass = Utilities::MPI::sum(diag_sums.mass, mpi_comm);
+        const double min = Utilities::MPI::min(diag_sums.min, mpi_comm);
+        const double max = Utilities::MPI::max(diag_sums.max, mpi_comm);
+        const double error = std::sqrt(Utilities::MPI::sum(diag_sums.error_sq, mpi_comm));
+        deallog << "Diagnostics step " << time_counter << " time " << cur_time << ": mass " <<
+                mass << " (change " << mass - diag_initial_mass << "), min " << min << ", max " <<
+                max;
+        if(exact_solution) deallog << ", L2 error " << error;
+        deallog << std::endl;
+        if(Utilities::MPI::this_mpi_process(mpi_comm) != 0) return;
+        csv << time_counter << "," << cur_time << "," << mass << "," << mass - diag_initial_mass <<
+                "," << min << "," << max << ",";
+        if(exact_solution) csv << error;
+        csv << "\n";
+}
+
+/**
+ * @brief Advances all members of the ensemble (see set_ensemble()) from advection2D::cur_time to
+ * @p end_time, like time_loop()
+ * 
+ * Every step is done by integrate() on advection2D::ensemble_solution with
+ * apply_ensemble_operator(). All members are written at the start, every @p output_interval steps
+ * if it is positive, and at the end, see output_ensemble(). There are no checkpoints and no mesh
+ * adaptation.
+ */
+void advection2D::ensemble_time_loop(const double end_time, const double courant,
+        const std::string &base_name, const uint output_interval)
+{
+        Assert(n_members > 0, ExcMessage("Ensemble is not set up"));
+        double time_step;
+        bool last_step;
+        output_ensemble(base_name, 0, cur_time);
+        while(cur_time < end_time){
+                if(wind_fn.dependence == wind_dependence::general){
+                        update_wind(cur_time);
+                        update_time_steps();
+                }
+                time_step = stable_time_step(courant);
+                last_step = cur_time + time_step*(1.0 + 1e-8) >= end_time;
+                if(last_step) time_step = end_time - cur_time;
+                deallog << "Step " << time_counter << " time " << cur_time << " time step " <<
+                        time_step << std::endl;
+                integrate(time_step, ensemble_solution, ensemble_old_solution,
+                        &advection2D::apply_ensemble_operator);
+                time_counter++;
+                cur_time = last_step ? end_time : cur_time + time_step;
+                if(last_step || (output_interval > 0 && time_counter%output_interval == 0)){
+                        output_ensemble(base_name, time_counter, cur_time);
+                }
+        }
+        writer.flush();
+}
+
+/**
+ * @brief Outputs every member of the ensemble with output(), member @p m with the base name
+ * @p base_name_member_m
+ * 
+ * The members are copied one at a time into advection2D::g_solution, which is not used otherwise
+ * in ensemble mode.
+ */
+void advection2D::output_ensemble(const std::string &base_name, const uint counter,
+        const double time)
+{
+        const uint n_digits = Utilities::int_to_string(n_members - 1).size();
+        for(uint m=0; m<n_members; m++){
+                for(uint i=0; i<g_solution.local_size(); i++){
+                        g_solution.local_element(i) =
+                                ensemble_solution.local_element(i*n_members + m);
+                }
+                output(base_name + "_member_" + Utilities::int_to_string(m, n_digits), counter,
+                        time);
+        }
+}
+
+/**
+ * @brief Computes the modal decay indicator of every owned cell from advection2D::g_solution
+ * 
+ * The cell values are transformed to the orthonormal Legendre basis
+ * @f$\psi_a(\xi)\psi_b(\eta)@f$, @f$\psi_k(x) = \sqrt{2k+1}P_k(2x-1)@f$, by applying the inverse
+ * of the 1D Vandermonde matrix at the support points along both directions. The indicator of cell
+ * @f$K@f$ is the norm of its modes of the highest degree @f$N@f$
+ * @f[
+ * \eta_K = \sqrt{|K|\sum_{\max(a,b)=N} m_{ab}^2}
+ * @f]
+ * which estimates the part of the solution not resolved by the lower modes. So it is large at
+ * fronts and decays fast where the solution is smooth. Only the values of the cell itself are
+ * used, so there is no communication. For degree 0, there are no higher modes and the indicator
+ * is zero.
+ * 
+ * @param[out] indicator Values indexed by active cell index, zero for cells not locally owned
+ */
+void advection2D::compute_smoothness_indicator(Vector<float> &indicator) const
+{
+        indicator = 0;
+        if(fe.degree == 0) return;
+        const uint n = fe_face.dofs_per_face;
+        const FE_DGQ<1> fe_1d(fe.degree);
+        const std::vector<Point<1>> &support_points = fe_1d.get_unit_support_points();
+        FullMatrix<double> vandermonde(n), modal(n);
+        std::vector<double> legendre(n);
+        uint a, k;
+        for(a=0; a<n; a++){
+                const double x = 2*support_points[a](0) - 1;
+                legendre[0] = 1;
+                legendre[1] = x;
+                for(k=2; k<n; k++){
+                        legendre[k] = ((2*k - 1)*x*legendre[k-1] - (k - 1)*legendre[k-2])/k;
+                }
+                for(k=0; k<n; k++) vandermonde(a,k) = std::sqrt(2*k + 1.0)*legendre[k];
+        }
+        modal.invert(vandermonde);
+
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, n, &modal, &indicator](const uint begin, const uint end){
+                        std::vector<double> temp(n*n);
+                        uint c, a, b, k, l;
+                        double mode, sum;
+                        for(c=begin; c<end; c++){
+                                const double *phi = g_solution.begin() + c*fe.dofs_per_cell;
+                                // along x: temp(k,b)
+                                for(b=0; b<n; b++){
+                                        for(k=0; k<n; k++){
+                                                temp[k + n*b] = 0;
+                                                for(a=0; a<n; a++){
+                                                        temp[k + n*b] += modal(k,a)*phi[a + n*b];
+                                                }
+                                        }
+                                }
+                                // along y, only the modes of highest degree
+                                sum = 0;
+                                for(l=0; l<n; l++){
+                                        for(k=0; k<n; k++){
+                                                if(k != n-1 && l != n-1) continue;
+                                                mode = 0;
+                                                for(b=0; b<n; b++) mode += modal(l,b)*temp[k + n*b];
+                                                sum += mode*mode;
+                                        }
+                                }
+                                indicator(cells[c]->active_cell_index()) =
+                                        std::sqrt(cells[c]->measure()*sum);
+                        } // loop over cells
+                },
+                64
+        );
+}
+
+/**
+ * @brief Refines and coarsens the mesh based on compute_smoothness_indicator() and transfers
+ * advection2D::g_solution to the new mesh
+ * 
+ * 1. The background output is flushed, since it uses the current mesh
+ * 2. Cells are flagged with the fixed fraction strategy (see set_adaptivity()), using the
+ * distributed version with p4est, and the flags are limited to the allowed levels
+ * 3. The solution is transferred with <code>SolutionTransfer</code>, or its distributed version
+ * with p4est, which uses the embedding and restriction matrices of advection2D::fe
+ * 4. The dofs and face data, including the hanging faces, are rebuilt on the new mesh by
+ * setup_dofs() and the system is assembled by reassemble_system(), which computes the operators
+ * of the changed cells only. The cells are matched through their <code>CellId</code>
+ * 
+ * The stable time step is updated in the assembly, so time_loop() picks it up in the next step.
+ */
+void advection2D::adapt_mesh()
+{
+        writer.flush();
+        Vector<float> indicator(triang.n_active_cells());
+        compute_smoothness_indicator(indicator);
+        #ifdef DEAL_II_WITH_P4EST
+        parallel::distributed::GridRefinement::refine_and_coarsen_fixed_fraction(triang, indicator,
+                adapt_refine_fraction, adapt_coarsen_fraction);
+        #else
+        GridRefinement::refine_and_coarsen_fixed_fraction(triang, indicator, adapt_refine_fraction,
+                adapt_coarsen_fraction);
+        #endif
+        for(const auto &cell: triang.active_cell_iterators()){
+                if(!cell->is_locally_owned()) continue;
+                if(cell->level() >= static_cast<int>(adapt_max_level)) cell->clear_refine_flag();
+                if(cell->level() <= static_cast<int>(adapt_min_level)) cell->clear_coarsen_flag();
+        }
+
+        // owned cells before adaptation
+        std::map<CellId, uint> old_cell_ids;
+        for(uint c=0; c<cells.size(); c++) old_cell_ids[cells[c]->id()] = c;
+
+        triang.prepare_coarsening_and_refinement();
+        #ifdef DEAL_II_WITH_P4EST
+        parallel::distributed::SolutionTransfer<2, state> solution_transfer(dof_handler);
+        solution_transfer.prepare_for_coarsening_and_refinement(g_solution);
+        triang.execute_coarsening_and_refinement();
+        setup_dofs();
+        // the transfer writes owned entries only
+        state transferred;
+        transferred.reinit(dof_handler.locally_owned_dofs(), mpi_comm);
+        solution_transfer.interpolate(transferred);
+        g_solution.copy_locally_owned_data_from(transferred);
+        #else
+        SolutionTransfer<2, state> solution_transfer(dof_handler);
+        const state old_solution(g_solution);
+        solution_transfer.prepare_for_coarsening_and_refinement(old_solution);
+        triang.execute_coarsening_and_refinement();
+        setup_dofs();
+        solution_transfer.interpolate(old_solution, g_solution);
+        #endif
+
+        std::vector<uint> old_cells(cells.size(), numbers::invalid_unsigned_int);
+        for(uint c=0; c<cells.size(); c++){
+                const auto it = old_cell_ids.find(cells[c]->id());
+                if(it != old_cell_ids.end()) old_cells[c] = it->second;
+        }
+        reassemble_system(old_cells);
+        deallog << "Mesh adapted: " << triang.n_global_active_cells() << " cells, " <<
+                dof_handler.n_dofs() << " dofs" << std::endl;
+}
+
+// Carpenter-Kennedy coefficients of time_integrator::lsrk45, C are the stage times
+static const std::array<double, 5> lsrk45_A = {
+        0.0,
+        -567301805773.0/1357537059087.0,
+        -2404267990393.0/2016746695238.0,
+        -3550918686646.0/2091501179385.0,
+        -1275806237668.0/842570457699.0
+};
+static const std::array<double, 5> lsrk45_B = {
+        1432997174477.0/9575080441755.0,
+        5161836677717.0/13612068292357.0,
+        1720146321549.0/2090206949498.0,
+        3134564353537.0/4481467310338.0,
+        2277821191437.0/14882151754819.0
+};
+
+static const std::array<double, 5> lsrk45_C = {
+        0.0,
+        1432997174477.0/9575080441755.0,
+        2526269341429.0/6820363962896.0,
+        2006345519317.0/3224310063776.0,
+        2802321613138.0/2924317926251.0
+};
+
+/**
+ * @brief Updates solution with the given @p time_step using advection2D::integrator
+ * 
+ * The Runge-Kutta schemes are done by integrate() with advection2D::g_solution and
+ * advection2D::gold_solution as registers and apply_operator() as the operator.
+ * time_integrator::lts_forward_euler is done by update_lts(), with @p time_step being the step of
+ * the slowest level. While the solution is on the device (see set_device()), the step is done by
+ * integrate_device() instead.
+ * 
+ * @pre @p time_step must be a stable one, any checks on this value are not done
+ */
+void advection2D::update(const double time_step)
+{
+        if(device_resident) integrate_device(time_step);
+        else if(integrator == time_integrator::lts_forward_euler) update_lts(time_step);
+        else integrate(time_step, g_solution, gold_solution, &advection2D::apply_operator);
+}
+
+/**
+ * @brief Advances @p u by @p time_step with a Runge-Kutta scheme of advection2D::integrator
+ * 
+ * All the schemes use only @p u and @p v as registers, and every stage is a single call to
+ * @p apply, which is apply_operator() or apply_ensemble_operator(). @f$R@f$ is the rhs operator
+ * (see rhs()).
+ * - time_integrator::forward_euler: @f$v = u + \Delta t R(u)@f$, then @f$u@f$ and @f$v@f$ are
+ * swapped. So the solution is never copied.
+ * - time_integrator::ssprk3 (Shu-Osher form):
+ * @f{align*}{
+ * v &= u + \Delta t R(u)\\
+ * v &= \tfrac{1}{4}v + \tfrac{1}{4}\Delta t R(v) + \tfrac{3}{4}u\\
+ * u &= \tfrac{2}{3}v + \tfrac{2}{3}\Delta t R(v) + \tfrac{1}{3}u
+ * @f}
+ * - time_integrator::lsrk45 (Williamson 2N storage form), for stages @f$i=1,\dots,5@f$:
+ * @f{align*}{
+ * v &= A_iv + \Delta t R(u)\\
+ * u &= u + B_iv
+ * @f}
+ * with @f$A_1 = 0@f$. The coefficients are from Carpenter and Kennedy, "Fourth-order 2N-storage
+ * Runge-Kutta schemes", NASA TM-109112, 1994. The second line is a vector update.
+ * 
+ * The step starts at advection2D::cur_time, and every stage passes its time to @p apply for a
+ * time dependent wind.
+ * 
+ * The stages may write into their input vector since the cell phase of apply_operator() only
+ * reads the entries of the cell being computed. See apply_operator().
+ * 
+ * If advection2D::diagnose_step is set, the diagnostics are accumulated while the final stage is
+ * written, see set_diagnostics().
+ * 
+ * @pre advection2D::integrator must not be time_integrator::lts_forward_euler
+ */
+void advection2D::integrate(const double time_step, state &u, state &v, const operator_fn apply)
+{
+        const double t = cur_time;
+        switch(integrator){
+                case time_integrator::forward_euler:
+                        diagnose = diagnose_step;
+                        (this->*apply)(u, v, t, 1.0, time_step, 0.0, nullptr);
+                        diagnose = false;
+                        u.swap(v);
+                        break;
+                case time_integrator::ssprk3:
+                        (this->*apply)(u, v, t, 1.0, time_step, 0.0, nullptr);
+                        (this->*apply)(v, v, t + time_step, 0.25, 0.25*time_step, 0.75, &u);
+                        diagnose = diagnose_step;
+                        (this->*apply)(v, u, t + 0.5*time_step, 2.0/3, 2.0/3*time_step, 1.0/3, &u);
+                        diagnose = false;
+                        break;
+                case time_integrator::lsrk45:
+                        for(uint i=0; i<lsrk45_A.size(); i++){
+                                (this->*apply)(u, v, t + lsrk45_C[i]*time_step, 0.0, time_step,
+                                        lsrk45_A[i], i == 0 ? nullptr : &v);
+                                INSTRUMENT_BEGIN(vector_update);
+                                if(diagnose_step && i+1 == lsrk45_A.size()){
+                                        add_and_diagnose(u, lsrk45_B[i], v);
+                                }
+                                else u.add(lsrk45_B[i], v);
+                                INSTRUMENT_END(vector_update, u.local_size(),
+                                        3*u.local_size()*sizeof(double), 2*u.local_size());
+                        }
+                        break;
+                default:
+                        AssertThrow(false, ExcMessage("Not a Runge-Kutta scheme"));
+        }
+}
+
+/**
+ * @brief Uploads the operators, face connectivity and solution to a device_operator, after which
+ * the solution is on the device
+ * 
+ * The device applies the stored matrices of apply_operator() with the cached wind normal products,
+ * so it needs a steady or separable wind and a stored operator mode. Faces shared with ghost cells
+ * and hanging faces are not handled on the device, so the mesh must be conforming, on a single
+ * process and not adapted.
+ */
+void advection2D::upload_to_device()
+{
+        AssertThrow(op_mode != operator_mode::sum_factorized &&
+                wind_fn.dependence != wind_dependence::general,
+                ExcMessage("The device needs stored matrices and a steady or separable wind"));
+        AssertThrow(integrator != time_integrator::lts_forward_euler,
+                ExcMessage("The device supports the Runge-Kutta schemes only"));
+        AssertThrow(n_internal_faces == n_flux_faces && n_flux_faces == faces.size() &&
+                adapt_interval == 0,
+                ExcMessage("The device needs a conforming mesh on a single process"));
+
+        const uint n_cells = cells.size();
+        std::vector<uint> face_owners(faces.size()), face_boundary_ids(n_boundary_faces);
+        for(uint f=0; f<faces.size(); f++){
+                face_owners[f] = faces[f].owner;
+                if(f < n_boundary_faces) face_boundary_ids[f] = faces[f].boundary_id;
+        }
+        device_operator_data data;
+        data.dofs_per_cell = fe.dofs_per_cell;
+        data.dofs_per_face = fe_face.dofs_per_face;
+        data.n_cells = n_cells;
+        data.n_faces = faces.size();
+        data.n_boundary_faces = n_boundary_faces;
+        data.n_ops = n_ops;
+        data.op_block_size = op_block_size();
+        data.op_data = op_data;
+        data.cell_op_ids = cell_op_ids.data();
+        data.cell_op_scales = cell_op_scales.data();
+        data.cell_faces = cell_faces.data();
+        data.face_owners = face_owners.data();
+        data.face_boundary_ids = face_boundary_ids.data();
+        data.face_dof_ids = face_dof_ids.data();
+        data.face_dof_ids_neighbor = face_dof_ids_neighbor.data();
+        data.face_wind_normal = face_wind_normal.data();
+        data.face_abs_wind_normal = face_abs_wind_normal.data();
+        data.face_first_dof = face_first_dof;
+        data.face_dof_increment = face_dof_increment;
+        if(!device) device = std::make_unique<device_operator>();
+        device->upload(data);
+        device->set_solution(0, g_solution.begin());
+        device_resident = true;
+}
+
+/**
+ * @brief Copies the solution on the device to advection2D::g_solution, if it is on the device
+ * 
+ * The solution stays on the device.
+ */
+void advection2D::download_from_device()
+{
+        if(device_resident) device->get_solution(0, g_solution.begin());
+}
+
+/**
+ * @brief Same as integrate() for the solution on the device, with device registers 0 and 1 as
+ * @f$u@f$ and @f$v@f$ and apply_device_operator() as the operator
+ */
+void advection2D::integrate_device(const double time_step)
+{
+        const uint none = device_operator::no_register;
+        const double t = cur_time;
+        switch(integrator){
+                case time_integrator::forward_euler:
+                        apply_device_operator(0, 1, t, 1.0, time_step, 0.0, none);
+                        device->swap(0, 1);
+                        break;
+                case time_integrator::ssprk3:
+                        apply_device_operator(0, 1, t, 1.0, time_step, 0.0, none);
+                        apply_device_operator(1, 1, t + time_step, 0.25, 0.25*time_step, 0.75, 0);
+                        apply_device_operator(1, 0, t + 0.5*time_step, 2.0/3, 2.0/3*time_step,
+                                1.0/3, 0);
+                        break;
+                case time_integrator::lsrk45:
+                        for(uint i=0; i<lsrk45_A.size(); i++){
+                                apply_device_operator(0, 1, t + lsrk45_C[i]*time_step, 0.0,
+                                        time_step, lsrk45_A[i], i == 0 ? none : 1);
+                                device->add(0, lsrk45_B[i], 1);
+                        }
+                        break;
+                default:
+                        AssertThrow(false, ExcMessage("Not a Runge-Kutta scheme"));
+        }
+}
+
+/**
+ * @brief Sets device register @p out to @f$a\,@f$@p in@f$ + b\,R(@f$@p in@f$) + c\,@f$@p w at
+ * @p time, like apply_operator()
+ * 
+ * Only the boundary values of advection2D::bcs at @p time and the wind factor of a separable wind
+ * are computed on the host.
+ */
+void advection2D::apply_device_operator(const uint in, const uint out, const double time,
+        const double a, const double b, const double c, const uint w)
+{
+        std::array<double, n_boundary_ids> bc_values;
+        std::array<bool, n_boundary_ids> bc_extrapolations;
+        for(uint id=0; id<n_boundary_ids; id++){
+                bc_extrapolations[id] = bcs[id].type == bc_type::extrapolation;
+                bc_values[id] = bc_extrapolations[id] ? 0.0 : bcs[id].value_at(time);
+        }
+        device->apply(in, out, a, wind_factor(time)*b, c, w, bc_values, bc_extrapolations);
+}
+
+/**
+ * @brief Returns the highest level, up to @p max_level, whose steps start at fine step @p s of
+ * update_lts(), i.e., the number of trailing zero bits of @p s
+ */
+static uint step_level(const uint s, const uint max_level)
+{
+        uint level = 0;
+        while(level < max_level && ((s >> level) & 1u) == 0) level++;
+        return level;
+}
+
+/**
+ * @brief Advances advection2D::g_solution by @p time_step with local time stepping
+ * 
+ * The step is split into @f$2^{L}@f$ fine steps of size @f$\delta@f$, where @f$L+1@f$ is
+ * advection2D::n_time_step_levels. A cell of level @f$k@f$ (see setup_local_time_stepping())
+ * takes forward Euler steps of size @f$2^k\delta@f$. In fine step @f$s@f$:
+ * - The fluxes of faces whose level steps start at @f$s@f$ are computed with the flux kernels of
+ * apply_operator(), from the current values of both sides. The values of the slower side of a
+ * level interface are those at the start of its own step.
+ * - At level interfaces, the flux times the face step is added to advection2D::face_flux_sums,
+ * see accumulate_face_fluxes()
+ * - The cells whose steps end after @f$s@f$ are updated in place by compute_lts_cells()
+ * 
+ * The faster side of a face lifts the flux of its own step, while the slower side lifts the sum of
+ * the flux integrals over all the steps of the faster side within its own step. Both sides then
+ * see the same flux integral, so the scheme is conservative across level interfaces. This is the
+ * multirate forward Euler scheme of Osher and Sanders, "Numerical approximations to nonlinear
+ * conservation laws with locally varying time and space grids", Math. Comp. 41, 1983. It is first
+ * order in time and every cell of level @f$k@f$ is updated only @f$2^{L-k}@f$ times per step.
+ * 
+ * Cells are updated only at the end of their steps and faces read cell values only before the
+ * updates of a fine step, so a single solution vector is used. The ghost entries of
+ * advection2D::g_solution are exchanged in every fine step. The step starts at
+ * advection2D::cur_time, which is used for the factor of a separable wind.
+ */
+void advection2D::update_lts(const double time_step)
+{
+        const uint max_level = n_time_step_levels - 1;
+        const uint n_sub_steps = 1u << max_level;
+        const double sub_step = time_step/n_sub_steps;
+        const std::array<uint, 5> range_begins = {0u, n_boundary_faces, n_internal_faces,
+                n_local_faces, n_shared_faces};
+        uint s, r, level;
+        for(s=0; s<n_sub_steps; s++){
+                const std::array<uint, 5> &face_ends = lts_face_ends[step_level(s, max_level)];
+                const double time = cur_time + s*sub_step;
+                g_solution.update_ghost_values_start();
+                parallel::apply_to_subranges(range_begins[0], face_ends[0],
+                        [this, time](const uint begin, const uint end){
+                                (this->*kernels.boundary_fluxes)(g_solution, time, begin, end);
+                        },
+                        64
+                );
+                parallel::apply_to_subranges(range_begins[1], face_ends[1],
+                        [this](const uint begin, const uint end){
+                                (this->*kernels.internal_fluxes)(g_solution, begin, end);
+                        },
+                        256
+                );
+                parallel::apply_to_subranges(range_begins[2], face_ends[2],
+                        [this](const uint begin, const uint end){
+                                compute_hanging_fluxes(g_solution, begin, end);
+                        },
+                        64
+                );
+                g_solution.update_ghost_values_finish();
+                parallel::apply_to_subranges(range_begins[3], face_ends[3],
+                        [this](const uint begin, const uint end){
+                                (this->*kernels.internal_fluxes)(g_solution, begin, end);
+                        },
+                        256
+                );
+                parallel::apply_to_subranges(range_begins[4], face_ends[4],
+                        [this](const uint begin, const uint end){
+                                compute_hanging_fluxes(g_solution, begin, end);
+                        },
+                        64
+                );
+                g_solution.zero_out_ghosts();
+                const double face_factor = wind_factor(cur_time + s*sub_step);
+                for(r=0; r<5; r++){
+                        parallel::apply_to_subranges(range_begins[r], face_ends[r],
+                                [this, sub_step, face_factor](const uint begin, const uint end){
+                                        accumulate_face_fluxes(begin, end, sub_step, face_factor);
+                                },
+                                256
+                        );
+                }
+
+                // every cell completes its step in the last fine step
+                diagnose = diagnose_step && s+1 == n_sub_steps;
+                for(level=0; level<=step_level(s+1, max_level); level++){
+                        // the step of the level started 2^level fine steps before the end of s
+                        const double cell_factor = wind_factor(cur_time +
+                                (s + 1 - (1u << level))*sub_step);
+                        parallel::apply_to_subranges(0u,
+                                static_cast<uint>(lts_level_cells[level].size()),
+                                [this, level, sub_step, cell_factor](const uint begin,
+                                        const uint end){
+                                        compute_lts_cells(level, begin, end, sub_step, cell_factor);
+                                },
+                                32
+                        );
+                }
+                diagnose = false;
+        } // loop over fine steps
+}
+
+/**
+ * @brief Scales the fluxes of faces in @p [begin,end) by the wind factor @p factor and adds the
+ * flux integrals over the current step of level interface faces to advection2D::face_flux_sums
+ * 
+ * A face of level @f$k@f$ contributes its flux times @f$2^k@f$ @p sub_step. @p factor is
+ * wind_factor() at the start of the face step, see set_wind().
+ */
+void advection2D::accumulate_face_fluxes(const uint begin, const uint end, const double sub_step,
+        const double factor)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        uint f, i;
+        if(factor != 1.0){
+                for(i=begin*dofs_per_face; i<end*dofs_per_face; i++) face_fluxes[i] *= factor;
+        }
+        for(f=begin; f<end; f++){
+                if(!face_level_interfaces[f]) continue;
+                const double face_step = sub_step*(1u << face_levels[f]);
+                for(i=f*dofs_per_face; i<(f+1)*dofs_per_face; i++){
+                        face_flux_sums[i] += face_step*face_fluxes[i];
+                }
+        }
+}
+
+/**
+ * @brief Does the forward Euler step of the cells in @p [begin,end) of level @p level in
+ * update_lts()
+ * 
+ * The positions are in advection2D::lts_level_cells. The stiffness term is computed from the
+ * current cell values, which are those at the start of the step of the cell, and multiplied by
+ * the step @f$2^k@f$ @p sub_step and the wind factor @p factor at the start of the step. The faces
+ * are lifted with the flux integrals given by get_lts_face_flux(). The kernels with runtime sizes
+ * are used, see compute_cells().
+ */
+void advection2D::compute_lts_cells(const uint level, const uint begin, const uint end,
+        const double sub_step, const double factor)
+{
+        const uint dofs_per_cell = fe.dofs_per_cell;
+        AlignedVector<double> &work = cell_work.get();
+        if(work.size() < dofs_per_cell + sf.n_work()) work.resize(dofs_per_cell + sf.n_work());
+        double *cur_rhs = work.data();
+        std::array<double, flux_batch_size> flux;
+        double *phi_ptr = g_solution.begin();
+        const double cell_step = sub_step*(1u << level)*factor;
+        diagnostics sums; // of the cells updated, if advection2D::diagnose
+        uint i, j, face_id, f;
+        for(i=begin; i<end; i++){
+                const uint cell = lts_level_cells[level][i];
+                const uint offset = cell*dofs_per_cell;
+                for(j=0; j<dofs_per_cell; j++) cur_rhs[j] = 0.0;
+                add_stiffness<-1>(cell, phi_ptr + offset, cur_rhs, work.data() + dofs_per_cell);
+                for(j=0; j<dofs_per_cell; j++) cur_rhs[j] *= cell_step;
+                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                        f = cell_faces[cell*GeometryInfo<2>::faces_per_cell + face_id];
+                        get_lts_face_flux(f, level, sub_step, flux.data());
+                        add_lifting<-1>(cell, face_id, flux.data(),
+                                faces[f].owner == cell ? -1.0 : 1.0, cur_rhs);
+                }
+                for(j=0; j<dofs_per_cell; j++){
+                        phi_ptr[offset + j] += cell_op_scales[cell]*cur_rhs[j];
+                }
+                if(diagnose){
+                        add_cell_diagnostics<-1>(cell, phi_ptr + offset,
+                                work.data() + dofs_per_cell, sums);
+                }
+        } // loop over cells
+        if(diagnose) merge_diagnostics(sums);
+}
+
+/**
+ * @brief Gets the integral wrt owner of the flux of face @p f over the current step of its side
+ * of level @p level
+ * 
+ * If the face has the same level, this is the latest flux times the step. Else this side is the
+ * slower side of a level interface, and the integral is taken from advection2D::face_flux_sums,
+ * which is then reset for the next step of this side. For a coarse side face, the integrals of
+ * its two hanging faces are projected as in compute_coarse_fluxes().
+ */
+void advection2D::get_lts_face_flux(const uint f, const uint level, const double sub_step,
+        double *flux)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        uint i, k, subface;
+        if(f >= n_flux_faces){
+                std::array<double, flux_batch_size> fine_flux;
+                for(i=0; i<dofs_per_face; i++) flux[i] = 0.0;
+                for(subface=0; subface<2; subface++){
+                        get_lts_face_flux(coarse_subfaces[f - n_flux_faces][subface], level,
+                                sub_step, fine_flux.data());
+                        const std::vector<double> &projection = subface_projection[subface];
+                        for(i=0; i<dofs_per_face; i++){
+                                for(k=0; k<dofs_per_face; k++){
+                                        flux[i] -= projection[i*dofs_per_face + k]*fine_flux[k];
+                                }
+                        }
+                }
+                return;
+        }
+        if(face_levels[f] == level){
+                const double face_step = sub_step*(1u << level);
+                for(i=0; i<dofs_per_face; i++) flux[i] = face_step*face_fluxes[f*dofs_per_face + i];
+                return;
+        }
+        double *flux_sum = &face_flux_sums[f*dofs_per_face];
+        for(i=0; i<dofs_per_face; i++){
+                flux[i] = flux_sum[i];
+                flux_sum[i] = 0.0;
+        }
+}
+
+/**
+ * @brief Returns the number of rhs evaluations in an update() with advection2D::integrator
+ * 
+ * An update() with time_integrator::lts_forward_euler is counted as one evaluation, though the
+ * cells of finer levels are updated more than once in it
+ */
+uint advection2D::n_rhs_evaluations() const
+{
+        switch(integrator){
+                case time_integrator::ssprk3: return 3;
+                case time_integrator::lsrk45: return 5;
+                default: return 1;
+        }
+}
+
+/**
+ * @brief Computes the time derivative @p out @f$=R(@f$@p phi@f$)@f$ of the semi-discrete system
+ * at @p time
+ * 
+ * @p phi is not modified, except for its ghost entries. See apply_operator()
+ * 
+ * @pre @p out must have the same layout as advection2D::g_solution
+ */
+void advection2D::rhs(const state &phi, state &out, const double time)
+{
+        apply_operator(phi, out, time, 0.0, 1.0);
+}
+
+// modelled memory traffic and flops of the flux of a face dof, see instrumentation: the two side
+// values, their dof ids and the wind normal products are read and the flux is written
+static constexpr double face_dof_bytes = 5*sizeof(double) + 2*sizeof(uint);
+static constexpr double face_dof_flops = 7;
+
+/**
+ * @brief Computes @p out @f$= a\,@f$@p phi@f$ + b\,R(@f$@p phi@f$) + c\,@f$@p w, with the rhs
+ * operator @f$R@f$ at @p time
+ * 
+ * @p w is used only if it is not null. @p time matters only for a time dependent wind: a general
+ * wind is first evaluated at @p time by update_wind(), and for a separable wind, @p b is
+ * multiplied by wind_factor(). See set_wind()
+ * 
+ * Algorithm:
+ * - For every face in advection2D::faces:
+ *   - Get owner and neighbor side values using the stored face dof ids. For a boundary face, the
+ * neighbor side value is given by the condition of its id in advection2D::bcs
+ *   - Compute the numerical flux and store it in advection2D::face_fluxes
+ * - For every cell:
+ *   - Compute the stiffness term
+ *   - Use lifting matrices and stored fluxes of its 4 faces to compute the lifting terms
+ *   - Combine the cell rhs with old values into @p out
+ * 
+ * In the face phase, every face writes only its own fluxes. In the cell phase, every cell writes
+ * only its own entries of @p out. So both phases are done in parallel using
+ * <code>parallel::apply_to_subranges()</code>, without any locks or atomics. The number of threads
+ * can be limited by set_n_threads(). See compute_boundary_fluxes(), compute_internal_fluxes() and
+ * compute_cells(). Their instances specialised on the degree are called through
+ * advection2D::kernels, see select_kernels().
+ * 
+ * With MPI, the exchange of ghost entries of @p phi (neighbor side face dofs of faces shared with
+ * ghost cells) is started before the face phase. The boundary faces and internal faces between owned
+ * cells are computed while the exchange is in progress and the faces shared with ghost cells only
+ * after it finishes. The cell phase is purely local. The ghost entries of @p phi are zeroed at the
+ * end, so that it can be used in vector operations.
+ * 
+ * Hanging faces are computed by compute_hanging_fluxes() and their fluxes are transferred to the
+ * coarse side by compute_coarse_fluxes(), after all the other faces.
+ * 
+ * The face connectivity and dof ids are built in build_face_data() for every mesh and the wind
+ * normal products are cached in assemble_system(). So no deal.II accessor is traversed and no wind or
+ * mapping evaluation is done here, except the wind evaluation of update_wind() for a general wind.
+ * 
+ * @p out can be the same as @p phi or @p w, because the second phase of a cell only reads the
+ * entries of @p phi and @p w of the same cell, and these are read before being written.
+ * 
+ * @pre @p phi, @p out and @p w must have the layout of advection2D::g_solution
+ */
+void advection2D::apply_operator(const state &phi, state &out, const double time, const double a,
+        const double b, const double c, const state *w)
+{
+        update_wind(time);
+        const double scaled_b = wind_factor(time)*b;
+        [[maybe_unused]] const uint dofs_per_face = fe_face.dofs_per_face; // for instrumentation
+        phi.update_ghost_values_start();
+
+        // face phase, overlapped with ghost exchange
+        INSTRUMENT_BEGIN(boundary_fluxes);
+        parallel::apply_to_subranges(0u, n_boundary_faces,
+                [this, &phi, time](const uint begin, const uint end){
+                        (this->*kernels.boundary_fluxes)(phi, time, begin, end);
+                },
+                64
+        );
+        INSTRUMENT_END(boundary_fluxes, n_boundary_faces,
+                n_boundary_faces*dofs_per_face*face_dof_bytes,
+                n_boundary_faces*dofs_per_face*face_dof_flops);
+        INSTRUMENT_BEGIN(internal_fluxes);
+        parallel::apply_to_subranges(n_boundary_faces, n_internal_faces,
+                [this, &phi](const uint begin, const uint end){
+                        (this->*kernels.internal_fluxes)(phi, begin, end);
+                },
+                256
+        );
+        INSTRUMENT_END(internal_fluxes, n_internal_faces - n_boundary_faces,
+                (n_internal_faces - n_boundary_faces)*dofs_per_face*face_dof_bytes,
+                (n_internal_faces - n_boundary_faces)*dofs_per_face*face_dof_flops);
+        INSTRUMENT_BEGIN(hanging_fluxes);
+        parallel::apply_to_subranges(n_internal_faces, n_local_faces,
+                [this, &phi](const uint begin, const uint end){
+                        compute_hanging_fluxes(phi, begin, end);
+                },
+                64
+        );
+        INSTRUMENT_END(hanging_fluxes, n_local_faces - n_internal_faces,
+                (n_local_faces - n_internal_faces)*dofs_per_face*face_dof_bytes,
+                (n_local_faces - n_internal_faces)*dofs_per_face*
+                (face_dof_flops + 2*dofs_per_face));
+        INSTRUMENT_BEGIN(ghost_exchange);
+        phi.update_ghost_values_finish();
+        INSTRUMENT_END(ghost_exchange, phi.get_partitioner()->n_ghost_indices(),
+                phi.get_partitioner()->n_ghost_indices()*sizeof(double), 0);
+        INSTRUMENT_BEGIN(internal_fluxes);
+        parallel::apply_to_subranges(n_local_faces, n_shared_faces,
+                [this, &phi](const uint begin, const uint end){
+                        (this->*kernels.internal_fluxes)(phi, begin, end);
+                },
+                256
+        );
+        INSTRUMENT_END(internal_fluxes, n_shared_faces - n_local_faces,
+                (n_shared_faces - n_local_faces)*dofs_per_face*face_dof_bytes,
+                (n_shared_faces - n_local_faces)*dofs_per_face*face_dof_flops);
+        INSTRUMENT_BEGIN(hanging_fluxes);
+        parallel::apply_to_subranges(n_shared_faces, n_flux_faces,
+                [this, &phi](const uint begin, const uint end){
+                        compute_hanging_fluxes(phi, begin, end);
+                },
+                64
+        );
+        // needs the fluxes of all hanging faces
+        parallel::apply_to_subranges(n_flux_faces, static_cast<uint>(faces.size()),
+                [this](const uint begin, const uint end){
+                        compute_coarse_fluxes(begin, end);
+                },
+                64
+        );
+        INSTRUMENT_END(hanging_fluxes, faces.size() - n_shared_faces,
+                (faces.size() - n_shared_faces)*dofs_per_face*face_dof_bytes,
+                (n_flux_faces - n_shared_faces)*dofs_per_face*(face_dof_flops + 2*dofs_per_face));
+
+        // cell phase
+        INSTRUMENT_BEGIN(cells);
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, &phi, &out, a, scaled_b, c, w](const uint begin, const uint end){
+                        (this->*kernels.cells)(phi, out, a, scaled_b, c, w, begin, end);
+                },
+                32
+        );
+        #ifdef ADVECTION_INSTRUMENT
+        double cell_bytes, cell_flops;
+        cell_costs(cell_bytes, cell_flops);
+        INSTRUMENT_END(cells, cells.size(), cells.size()*cell_bytes, cells.size()*cell_flops);
+        #endif
+        phi.zero_out_ghosts();
+}
+
+/**
+ * @brief Gets the modelled memory traffic and flops of a cell in the cell phase of
+ * apply_operator(), see instrumentation
+ * 
+ * The traffic counts the cell values read and written, the third vector, the face fluxes and the
+ * data that is not shared between cells: the matrices in operator_mode::per_cell and the
+ * coefficients in operator_mode::sum_factorized. The shared matrices are assumed to be in cache.
+ * The flops are those of the matrix-vector products, or of the 1D passes of sum factorization
+ * (see sum_factorization).
+ */
+void advection2D::cell_costs(double &bytes, double &flops) const
+{
+        const double n = fe.dofs_per_cell, n_face = fe_face.dofs_per_face;
+        const uint faces_per_cell = GeometryInfo<2>::faces_per_cell;
+        bytes = (3*n + faces_per_cell*n_face)*sizeof(double);
+        if(op_mode == operator_mode::sum_factorized){
+                // 6 1D passes of 2 n_1d flops per entry, the coefficients and the face liftings
+                bytes += 2*n*sizeof(double);
+                flops = 12*n*n_face + 2*n + 2*faces_per_cell*n;
+        }
+        else{
+                if(op_mode == operator_mode::per_cell){
+                        bytes += (n + faces_per_cell*n_face)*n*
+                                (op_data_float == nullptr ? sizeof(double) : sizeof(float));
+                }
+                flops = 2*n*n + 2*faces_per_cell*n_face*n;
+        }
+        flops += 5*n; // combination with the old values
+}
+
+/**
+ * @brief Returns the kernels of apply_operator() specialised on @p degree
+ * 
+ * The table holds the instances for degrees 1 to 8, see dof_tables. Any other degree gets the
+ * instances with runtime sizes (<code>degree = -1</code>).
+ */
+advection2D::kernel_set advection2D::select_kernels(const uint degree)
+{
+        static const std::array<kernel_set, 8> table{
+                kernels_of_degree<1>(), kernels_of_degree<2>(), kernels_of_degree<3>(),
+                kernels_of_degree<4>(), kernels_of_degree<5>(), kernels_of_degree<6>(),
+                kernels_of_degree<7>(), kernels_of_degree<8>()
+        };
+        if(degree >= 1 && degree <= table.size()) return table[degree-1];
+        return kernels_of_degree<-1>();
+}
+
+/**
+ * @brief Returns pointers to the kernel instances of @p degree
+ */
+template <int degree>
+advection2D::kernel_set advection2D::kernels_of_degree()
+{
+        return kernel_set{
+                &advection2D::compute_boundary_fluxes<degree>,
+                &advection2D::compute_internal_fluxes<degree>,
+                &advection2D::compute_cells<degree>
+        };
+}
+
+/**
+ * @brief Computes numerical fluxes of boundary faces in @p [begin,end) wrt owner at @p time
+ * 
+ * The boundary faces are grouped by boundary id in build_face_data(), so @p [begin,end) consists of
+ * a few runs of faces with the same id. The type of the condition (see advection2D::bcs) is
+ * resolved once per run and the run is computed by compute_boundary_batch() with an inlined
+ * neighbor side value. The value of a time dependent condition is evaluated once per run.
+ */
+template <int degree>
+void advection2D::compute_boundary_fluxes(const state &phi, const double time, const uint begin,
+        const uint end)
+{
+        uint run_begin, run_end;
+        for(run_begin=begin; run_begin<end; run_begin=run_end){
+                const types::boundary_id id = faces[run_begin].boundary_id;
+                run_end = run_begin + 1;
+                while(run_end < end && faces[run_end].boundary_id == id) run_end++;
+                const boundary_condition &bc = bcs[id];
+                if(bc.type == bc_type::extrapolation){
+                        compute_boundary_batch<degree>(phi, run_begin, run_end,
+                                [](const double o_value){ return o_value; });
+                }
+                else{
+                        const double value = bc.value_at(time);
+                        compute_boundary_batch<degree>(phi, run_begin, run_end,
+                                [value](const double){ return value; });
+                }
+        } // loop over runs of boundary ids
+}
+
+/**
+ * @brief Computes numerical fluxes of boundary faces in @p [begin,end) wrt owner, with the
+ * neighbor side value given by @p bc from the owner side value
+ * 
+ * @p bc is a lambda, which is inlined into the gather loop. For @p degree > 0, the number of face
+ * dofs is a compile time constant, else it is taken from advection2D::fe_face.
+ * 
+ * The faces are processed in batches of at most advection2D::flux_batch_size face dofs. The owner
+ * and neighbor side values of a batch are gathered into contiguous buffers and the fluxes of the
+ * whole batch are computed by the vectorized rusanov_flux(). The face dofs of consecutive faces
+ * are contiguous in advection2D::face_dof_ids, advection2D::face_wind_normal and
+ * advection2D::face_fluxes, so a batch is a plain range of face dofs and these are used in place.
+ */
+template <int degree, typename bc_value>
+void advection2D::compute_boundary_batch(const state &phi, const uint begin, const uint end,
+        const bc_value &bc)
+{
+        const uint dofs_per_face = (degree > 0) ? degree+1 : fe_face.dofs_per_face;
+        Assert(dofs_per_face <= flux_batch_size, ExcInternalError());
+        const uint batch_size = (flux_batch_size/dofs_per_face)*dofs_per_face;
+        std::array<double, flux_batch_size> phi_owner, phi_neighbor; // owner and neighbor side values
+        uint batch_begin, n, i;
+        for(batch_begin=begin*dofs_per_face; batch_begin<end*dofs_per_face;
+                batch_begin+=batch_size){
+                n = std::min(end*dofs_per_face - batch_begin, batch_size);
+                for(i=0; i<n; i++){
+                        phi_owner[i] = phi.local_element(face_dof_ids[batch_begin + i]);
+                }
+                for(i=0; i<n; i++) phi_neighbor[i] = bc(phi_owner[i]); // vectorised
+                rusanov_flux(n, phi_owner.data(), phi_neighbor.data(),
+                        &face_wind_normal[batch_begin], &face_abs_wind_normal[batch_begin],
+                        &face_fluxes[batch_begin]);
+        } // loop over batches
+}
+
+/**
+ * @brief Computes numerical fluxes of internal faces in @p [begin,end) wrt owner
+ * 
+ * Used for faces between owned cells as well as faces shared with ghost cells. See
+ * compute_boundary_fluxes() for @p degree and the batching.
+ */
+template <int degree>
+void advection2D::compute_internal_fluxes(const state &phi, const uint begin, const uint end)
+{
+        const uint dofs_per_face = (degree > 0) ? degree+1 : fe_face.dofs_per_face;
+        Assert(dofs_per_face <= flux_batch_size, ExcInternalError());
+        // all faces of a batch are gathered at once, so the batch is a plain range of face dofs
+        const uint batch_size = (flux_batch_size/dofs_per_face)*dofs_per_face;
+        std::array<double, flux_batch_size> phi_owner, phi_neighbor; // owner and neighbor side values
+        uint batch_begin, batch_end, id;
+        for(batch_begin=begin*dofs_per_face; batch_begin<end*dofs_per_face;
+                batch_begin+=batch_size){
+                batch_end = std::min(end*dofs_per_face, batch_begin + batch_size);
+                for(id=batch_begin; id<batch_end; id++){
+                        // owner and neighbor side dof locations will match
+                        phi_owner[id - batch_begin] = phi.local_element(face_dof_ids[id]);
+                        phi_neighbor[id - batch_begin] = phi.local_element(face_dof_ids_neighbor[id]);
+                } // loop over face dofs of batch
+                rusanov_flux(batch_end - batch_begin, phi_owner.data(), phi_neighbor.data(),
+                        &face_wind_normal[batch_begin], &face_abs_wind_normal[batch_begin],
+                        &face_fluxes[batch_begin]);
+        } // loop over batches
+}
+
+/**
+ * @brief Computes numerical fluxes of hanging faces in @p [begin,end) wrt owner, the finer cell
+ * 
+ * The face dofs of the owner side are those of the fine cell. The neighbor side values at these
+ * points are interpolated from the face dofs of the coarse cell with
+ * advection2D::subface_interpolation. The fluxes are computed with the vectorized rusanov_flux()
+ * face by face. Since hanging faces are only a small fraction of faces, this is not specialised on
+ * the degree.
+ */
+void advection2D::compute_hanging_fluxes(const state &phi, const uint begin, const uint end)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        Assert(dofs_per_face <= flux_batch_size, ExcInternalError());
+        std::array<double, flux_batch_size> phi_owner, phi_neighbor, phi_coarse;
+        uint f, i, k, id;
+        for(f=begin; f<end; f++){
+                const std::vector<double> &interpolation = subface_interpolation[faces[f].subface];
+                for(i=0; i<dofs_per_face; i++){
+                        id = f*dofs_per_face + i;
+                        phi_owner[i] = phi.local_element(face_dof_ids[id]);
+                        phi_coarse[i] = phi.local_element(face_dof_ids_neighbor[id]);
+                }
+                for(i=0; i<dofs_per_face; i++){
+                        phi_neighbor[i] = 0.0;
+                        for(k=0; k<dofs_per_face; k++){
+                                phi_neighbor[i] += interpolation[i*dofs_per_face + k]*phi_coarse[k];
+                        }
+                }
+                rusanov_flux(dofs_per_face, phi_owner.data(), phi_neighbor.data(),
+                        &face_wind_normal[f*dofs_per_face], &face_abs_wind_normal[f*dofs_per_face],
+                        &face_fluxes[f*dofs_per_face]);
+        } // loop over faces
+}
+
+/**
+ * @brief Computes the fluxes of coarse side faces in @p [begin,end) wrt their owner, the coarse
+ * cell
+ * 
+ * The flux on the coarse side is the L2 projection of the fluxes of the two hanging faces onto the
+ * face polynomials of the coarse cell, done with advection2D::subface_projection. So the lifting
+ * of the coarse cell gets exactly the integral of the fine fluxes against its face basis, and the
+ * scheme stays conservative across the hanging face. The sign changes since the hanging face fluxes
+ * are wrt the fine cells.
+ *
+ * @pre The fluxes of all the hanging faces must be computed
+ */
+void advection2D::compute_coarse_fluxes(const uint begin, const uint end)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face;
+        uint f, subface, i, k;
+        for(f=begin; f<end; f++){
+                double *flux = &face_fluxes[f*dofs_per_face];
+                for(i=0; i<dofs_per_face; i++) flux[i] = 0.0;
+                for(subface=0; subface<2; subface++){
+                        const std::vector<double> &projection = subface_projection[subface];
+                        const uint fine_face = coarse_subfaces[f - n_flux_faces][subface];
+                        const double *fine_flux = &face_fluxes[fine_face*dofs_per_face];
+                        for(i=0; i<dofs_per_face; i++){
+                                for(k=0; k<dofs_per_face; k++){
+                                        flux[i] -= projection[i*dofs_per_face + k]*fine_flux[k];
+                                }
+                        }
+                }
+        } // loop over faces
+}
+
+/**
+ * @brief Adds the product of the row major @p n x @p n matrix @p mat with @p x to @p y
+ * 
+ * @p Number is the type of the stored operators, double or float (see set_float_operators()).
+ * Every matrix entry is converted to double, so that the sums are accumulated in double. @p T is
+ * double, or <code>VectorizedArray<double></code> for a cell batch.
+ */
+template <typename Number, typename T>
+static void add_matrix_product(const uint n, const Number *mat, const T *x, T *y)
+{
+        uint i, j;
+        T sum;
+        for(i=0; i<n; i++){
+                sum = 0.0;
+                for(j=0; j<n; j++) sum += static_cast<double>(mat[i*n + j])*x[j];
+                y[i] += sum;
+        }
+}
+
+/**
+ * @brief Adds the product of the @p n_face columns @p first_dof + i @p dof_increment of the row
+ * major @p n x @p n lifting matrix @p mat with @p factor times @p flux to @p y
+ * 
+ * See add_matrix_product() for @p Number and @p T
+ */
+template <typename Number, typename T>
+static void add_face_product(const uint n, const uint n_face, const uint first_dof,
+        const uint dof_increment, const Number *mat, const T *flux, const double factor, T *y)
+{
+        uint i, j, l_dof_id;
+        T cur_flux;
+        for(i=0; i<n_face; i++){
+                l_dof_id = first_dof + i*dof_increment;
+                cur_flux = factor*flux[i];
+                for(j=0; j<n; j++) y[j] += static_cast<double>(mat[j*n + l_dof_id])*cur_flux;
+        }
+}
+
+/**
+ * @brief Computes rhs of cells in @p [begin,end) and sets their entries of @p out to
+ * @f$a\,@f$@p phi@f$ + b\,@f$rhs@f$ + c\,@f$@p w
+ * 
+ * The fluxes in advection2D::face_fluxes are wrt owner. So they are lifted with a factor -1 for
+ * the owner and +1 for the neighbor (which includes the case of a ghost owner). The cell rhs is
+ * multiplied by advection2D::cell_op_scales. See assemble_system().
+ * 
+ * Owned dofs of a cell are contiguous in @p phi and @p out (see build_face_data()). So they are
+ * accessed through raw pointers without any gather or scatter. The cell rhs is kept in a per
+ * thread buffer, together with the scratch of add_stiffness(), which is allocated only once. For
+ * @p degree > 0, the cell rhs is a fixed size array on the stack instead and all loop trip counts
+ * are compile time constants.
+ * 
+ * Cells are processed in batches of the SIMD width by compute_cell_batch() wherever possible (see
+ * is_batchable()), the remaining cells one at a time.
+ * 
+ * If advection2D::diagnose is set, the cells just written are passed to add_cell_diagnostics()
+ * while still in cache, see set_diagnostics().
+ */
+template <int degree>
+void advection2D::compute_cells(const state &phi, state &out, const double a, const double b,
+        const double c, const state *w, const uint begin, const uint end)
+{
+        constexpr uint fixed_dofs_per_cell = (degree > 0) ? (degree+1)*(degree+1) : 1;
+        const uint dofs_per_cell = (degree > 0) ? fixed_dofs_per_cell : fe.dofs_per_cell;
+        const uint dofs_per_face = (degree > 0) ? degree+1 : fe_face.dofs_per_face;
+        AlignedVector<double> &work = cell_work.get();
+        if(work.size() < dofs_per_cell + sf.n_work()) work.resize(dofs_per_cell + sf.n_work());
+        std::array<double, fixed_dofs_per_cell> fixed_rhs;
+        double *cur_rhs = (degree > 0) ? fixed_rhs.data() : work.data();
+        const double *phi_ptr = phi.begin();
+        const double *w_ptr = (w == nullptr) ? nullptr : w->begin();
+        double *out_ptr = out.begin();
+        constexpr uint width = VectorizedArray<double>::n_array_elements;
+        diagnostics sums; // of the cells written, if advection2D::diagnose
+        uint cell = begin, i, face_id, f;
+        while(cell < end){
+                if(cell + width <= end && is_batchable(cell)){
+                        compute_cell_batch<degree>(phi_ptr, out_ptr, a, b, c, w_ptr, cell);
+                        if(diagnose){
+                                for(i=cell; i<cell+width; i++){
+                                        add_cell_diagnostics<degree>(i, out_ptr + i*dofs_per_cell,
+                                                work.data() + dofs_per_cell, sums);
+                                }
+                        }
+                        cell += width;
+                        continue;
+                }
+
+                const uint offset = cell*dofs_per_cell;
+                for(i=0; i<dofs_per_cell; i++) cur_rhs[i] = 0.0;
+                add_stiffness<degree>(cell, phi_ptr + offset, cur_rhs, work.data() + dofs_per_cell);
+                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                        f = cell_faces[cell*GeometryInfo<2>::faces_per_cell + face_id];
+                        add_lifting<degree>(cell, face_id, &face_fluxes[f*dofs_per_face],
+                                faces[f].owner == cell ? -1.0 : 1.0, cur_rhs);
+                }
+
+                const double scaled_b = cell_op_scales[cell]*b;
+                if(w_ptr == nullptr){
+                        for(i=0; i<dofs_per_cell; i++){
+                                out_ptr[offset + i] = a*phi_ptr[offset + i] + scaled_b*cur_rhs[i];
+                        }
+                }
+                else{
+                        for(i=0; i<dofs_per_cell; i++){
+                                out_ptr[offset + i] = a*phi_ptr[offset + i] + scaled_b*cur_rhs[i] +
+                                        c*w_ptr[offset + i];
+                        }
+                }
+                if(diagnose){
+                        add_cell_diagnostics<degree>(cell, out_ptr + offset,
+                                work.data() + dofs_per_cell, sums);
+                }
+                cell++;
+        } // loop over cells
+        if(diagnose) merge_diagnostics(sums);
+}
+
+/**
+ * @brief Returns whether the <code>VectorizedArray<double>::n_array_elements</code> cells from
+ * @p first_cell can be processed by compute_cell_batch()
  * 
- * 1. Mesh is setup and stored in advection2D::triang
- * 2. advection2D::dof_handler is linked to advection2D::fe
- * 3. advection2D::g_solution and advection2D::l_rhs sizes are set
- * 4. Sizes of advection2D::stiff_mats, advection2D::lift_mats and advection2D::l_rhs containers are
- * set
+ * This is true in operator_mode::sum_factorized, where the 1D matrices are common to all cells,
+ * and when all cells of the batch share the same operator block in advection2D::op_data. In
+ * operator_mode::per_cell, every cell has its own block and the batch is not possible.
  */
-void advection2D::setup_system()
+bool advection2D::is_batchable(const uint first_cell) const
 {
-        deallog << "Setting up the system" << std::endl;
-        // initialise the triang variable
-        GridGenerator::hyper_cube(triang);
-        triang.refine_global(5); // 2^5=32 cells in each direction, total length 1m
+        if(op_mode == operator_mode::sum_factorized) return true;
+        constexpr uint width = VectorizedArray<double>::n_array_elements;
+        for(uint lane=1; lane<width; lane++){
+                if(cell_op_ids[first_cell + lane] != cell_op_ids[first_cell]) return false;
+        }
+        return true;
+}
 
-        // set dof_handler
-        dof_handler.distribute_dofs(fe);
-        dof_locations.resize(dof_handler.n_dofs());
-        DoFTools::map_dofs_to_support_points(MappingQ1<2>(), dof_handler, dof_locations);
+/**
+ * @brief Same as compute_cells() for the batch of
+ * <code>VectorizedArray<double>::n_array_elements</code> cells starting from @p first_cell
+ * 
+ * The cell data is interleaved: lane @p l of entry @p i of a batch array is the value of dof @p i
+ * of cell <code>first_cell + l</code>. So every operation of the reference operator (the shared
+ * stiffness and lifting matrices, or the 1D matrices of sum factorization) is applied to all the
+ * cells of the batch at once. Only the per cell data, that is the sum factorization coefficients,
+ * the face fluxes and their signs and the operator scales, differs across lanes. The batch arrays
+ * are kept in a per thread buffer like in compute_cells().
+ * 
+ * @pre is_batchable() is true for @p first_cell
+ */
+template <int degree>
+void advection2D::compute_cell_batch(const double *phi, double *out, const double a, const double b,
+        const double c, const double *w, const uint first_cell)
+{
+        constexpr uint width = VectorizedArray<double>::n_array_elements;
+        const uint dofs_per_cell = (degree > 0) ? (degree+1)*(degree+1) : fe.dofs_per_cell;
+        const uint dofs_per_face = (degree > 0) ? degree+1 : fe_face.dofs_per_face;
+        const bool sum_factorized = (op_mode == operator_mode::sum_factorized);
+        // phi, rhs and face flux, then the coefficients and the scratch of sum factorization
+        const uint n_work = 2*dofs_per_cell + dofs_per_face +
+                (sum_factorized ? 2*dofs_per_cell + sf.n_work() : 0);
+        AlignedVector<VectorizedArray<double>> &work = cell_batch_work.get();
+        if(work.size() < n_work) work.resize(n_work);
+        VectorizedArray<double> *phi_batch = work.data(), *rhs_batch = work.data() + dofs_per_cell,
+                *flux_batch = work.data() + 2*dofs_per_cell,
+                *c_x = flux_batch + dofs_per_face, *c_y = c_x + dofs_per_cell,
+                *sf_work = c_y + dofs_per_cell;
+        VectorizedArray<double> inv_size; // face normal cell sizes in sum factorization
+        uint lane, cell, i, face_id, f, first_dof, dof_increment;
 
-        // no system_matrix because the solution is updated cell wise
-        g_solution.reinit(dof_handler.n_dofs());
-        gold_solution.reinit(dof_handler.n_dofs());
+        // interleave cell values
+        for(lane=0; lane<width; lane++){
+                const double *cell_phi = phi + (first_cell + lane)*dofs_per_cell;
+                for(i=0; i<dofs_per_cell; i++) phi_batch[i][lane] = cell_phi[i];
+        }
+        for(i=0; i<dofs_per_cell; i++) rhs_batch[i] = 0.0;
 
-        // set user flags for cell
-        // for a face, cell with lower user index will be treated owner
-        // is this reqd? can't we just use cell->index()?
-        // uint i=0;
-        // for(auto &cell: dof_handler.active_cell_iterators()){
-        //         cell->set_user_index(i++);
-        // } // loop over cells
+        // stiffness
+        if(sum_factorized){
+                // number of quad points equals number of dofs
+                for(lane=0; lane<width; lane++){
+                        const double *coeffs = &sf_coeffs[2*dofs_per_cell*(first_cell + lane)];
+                        for(i=0; i<dofs_per_cell; i++){
+                                c_x[i][lane] = coeffs[i];
+                                c_y[i][lane] = coeffs[dofs_per_cell + i];
+                        }
+                }
+                sf.apply_stiffness<(degree > 0) ? degree+1 : 0>(phi_batch, c_x, c_y, rhs_batch,
+                        sf_work);
+        }
+        else{
+                const std::size_t offset = std::size_t(cell_op_ids[first_cell])*op_block_size();
+                if(op_data_float != nullptr){
+                        add_matrix_product(dofs_per_cell, op_data_float + offset, phi_batch,
+                                rhs_batch);
+                }
+                else add_matrix_product(dofs_per_cell, op_data + offset, phi_batch, rhs_batch);
+        }
 
-        // set sizes of stiffness and lifting matrix containers
-        stiff_mats.resize(triang.n_active_cells());
-        lift_mats.resize(triang.n_active_cells());
+        // lifting
+        for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                for(lane=0; lane<width; lane++){
+                        cell = first_cell + lane;
+                        f = cell_faces[cell*GeometryInfo<2>::faces_per_cell + face_id];
+                        const double factor = faces[f].owner == cell ? -1.0 : 1.0;
+                        for(i=0; i<dofs_per_face; i++){
+                                flux_batch[i][lane] = factor*face_fluxes[f*dofs_per_face + i];
+                        }
+                        if(sum_factorized) inv_size[lane] = sf_inv_sizes[2*cell + face_id/2];
+                }
+                if(sum_factorized){
+                        sf.apply_lifting<(degree > 0) ? degree+1 : 0>(face_id, flux_batch, inv_size,
+                                rhs_batch);
+                        continue;
+                }
+                const std::size_t offset = std::size_t(cell_op_ids[first_cell])*op_block_size() +
+                        (face_id+1)*dofs_per_cell*dofs_per_cell;
+                get_face_dofs<degree>(face_id, first_dof, dof_increment);
+                if(op_data_float != nullptr){
+                        add_face_product(dofs_per_cell, dofs_per_face, first_dof, dof_increment,
+                                op_data_float + offset, flux_batch, 1.0, rhs_batch);
+                }
+                else{
+                        add_face_product(dofs_per_cell, dofs_per_face, first_dof, dof_increment,
+                                op_data + offset, flux_batch, 1.0, rhs_batch);
+                }
+        } // loop over faces
 
-        l_rhs.resize(triang.n_active_cells());
-        for(auto &cur_rhs: l_rhs) cur_rhs.reinit(fe.dofs_per_cell);
+        // combine and scatter back
+        for(lane=0; lane<width; lane++){
+                cell = first_cell + lane;
+                const uint offset = cell*dofs_per_cell;
+                const double scaled_b = cell_op_scales[cell]*b;
+                for(i=0; i<dofs_per_cell; i++){
+                        out[offset + i] = a*phi[offset + i] + scaled_b*rhs_batch[i][lane] +
+                                (w == nullptr ? 0.0 : c*w[offset + i]);
+                }
+        }
 }
 
 /**
- * @brief Assembles the system
- * 
- * Calculating mass and differentiation matrices is as usual. Each face will have its own flux
- * matrix. The containers advection2D::face_first_dof and advection2D::face_dof_increment are used
- * to map face-local dof index to cell dof index.
+ * @brief Computes @p out @f$= a\,@f$@p phi@f$ + b\,R(@f$@p phi@f$) + c\,@f$@p w for all members
+ * of the ensemble, like apply_operator()
  * 
- * @todo Check whether <code>FEFaceValues::reinit()</code> automatically takes care of direction of
- * integration for faces 0 and 3 since they are oriented in cw direction.
- * @remark Probably <code>FEFaceValues::reinit()</code> automatically takes care of direction of a
- * face because the code was working ok
+ * The vectors have the layout of advection2D::ensemble_solution, see set_ensemble(). The phases
+ * and the ghost exchange are those of apply_operator(), done by compute_ensemble_fluxes(),
+ * compute_ensemble_coarse_fluxes() and compute_ensemble_cells(). Every face dof and cell dof is
+ * visited once for all the members, so the face data and the operators are read once per
+ * application, instead of once per member as with separate runs. The prescribed boundary values of
+ * the members at @p time are evaluated once into advection2D::ensemble_bc_values.
  */
-void advection2D::assemble_system()
+void advection2D::apply_ensemble_operator(const state &phi, state &out, const double time,
+        const double a, const double b, const double c, const state *w)
 {
-        deallog << "Assembling system ... " << std::flush;
-        // allocate all local matrices
-        FullMatrix<double> l_mass(fe.dofs_per_cell),
-                l_mass_inv(fe.dofs_per_cell),
-                l_diff(fe.dofs_per_cell),
-                l_flux(fe.dofs_per_cell),
-                temp(fe.dofs_per_cell); // initialise with square matrix size
-        QGauss<2> cell_quad_formula(fe.degree+1); // (N+1) gauss quad for cell
-        QGauss<1> face_quad_formula(fe.degree+1); // for face
-        FEValues<2> fe_values(fe, cell_quad_formula,
-                update_values | update_gradients | update_JxW_values | update_quadrature_points);
-        FEFaceValues<2> fe_face_values(fe, face_quad_formula,
-                update_values | update_JxW_values | update_quadrature_points);
-        
-        uint i, j, i_face, j_face, qid, face_id;
-        // compute mass and diff matrices
-        for(auto &cell: dof_handler.active_cell_iterators()){
-                // deallog << "Assembling cell " << cell->index() << std::endl;
-                fe_values.reinit(cell);
-                l_mass = 0;
-                l_diff = 0;
-                for(qid=0; qid<fe_values.n_quadrature_points; qid++){
-                        for(i=0; i<fe.dofs_per_cell; i++){
-                                for(j=0; j<fe.dofs_per_cell; j++){
-                                        l_mass(i,j) += fe_values.shape_value(i, qid) *
-                                                fe_values.shape_value(j, qid) *
-                                                fe_values.JxW(qid);
-                                        l_diff(i,j) += fe_values.shape_grad(i, qid) *
-                                                wind(fe_values.quadrature_point(qid)) *
-                                                fe_values.shape_value(j, qid) *
-                                                fe_values.JxW(qid);
-                                } // inner loop cell shape fns
-                        } // outer loop cell shape fns
-                } // loop over cell quad points
-                l_mass_inv.invert(l_mass);
-                l_mass_inv.mmult(temp, l_diff); // store mass_inv * diff into temp
-                stiff_mats[cell->index()] = temp;
-
-                // each face will have a separate flux matrix
-                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
-                        fe_face_values.reinit(cell, face_id);
-                        l_flux = 0;
-                        for(qid=0; qid<fe_face_values.n_quadrature_points; qid++){
-                                for(i_face=0; i_face<fe_face.dofs_per_face; i_face++){
-                                        for(j_face=0; j_face<fe_face.dofs_per_face; j_face++){
-                                                // mapping
-                                                i = face_first_dof[face_id] +
-                                                        i_face*face_dof_increment[face_id];
-                                                j = face_first_dof[face_id] +
-                                                        j_face*face_dof_increment[face_id];
-                                                l_flux(i,j) +=
-                                                        fe_face_values.shape_value(i, qid) *
-                                                        fe_face_values.shape_value(j, qid) *
-                                                        fe_face_values.JxW(qid);
-                                        } // inner loop over face shape fns
-                                } // outer loop over face shape fns
-                        } // loop over face quad points
-                        l_mass_inv.mmult(temp, l_flux);
-                        lift_mats[cell->index()][face_id] = temp;
-                }// loop over faces
-
-                // Lifting matrices for faces 0 and 3 must be muliplied by -1 (?)
-                // not sure of this
-                // lift_mats[cell->index()][0] *= -1.0;
-                // lift_mats[cell->index()][3] *= -1.0;
-
-        }// loop over cells
-        deallog << "Completed assembly" << std::endl;
+        update_wind(time);
+        const double scaled_b = wind_factor(time)*b;
+        ensemble_bc_values.resize(n_boundary_ids*n_members);
+        for(uint id=0; id<n_boundary_ids; id++){
+                for(uint m=0; m<n_members; m++){
+                        ensemble_bc_values[id*n_members + m] = ensemble_bcs[m][id].value_at(time);
+                }
+        }
+        phi.update_ghost_values_start();
+        parallel::apply_to_subranges(0u, n_local_faces,
+                [this, &phi](const uint begin, const uint end){
+                        compute_ensemble_fluxes(phi, begin, end);
+                },
+                64
+        );
+        phi.update_ghost_values_finish();
+        parallel::apply_to_subranges(n_local_faces, n_flux_faces,
+                [this, &phi](const uint begin, const uint end){
+                        compute_ensemble_fluxes(phi, begin, end);
+                },
+                64
+        );
+        parallel::apply_to_subranges(n_flux_faces, static_cast<uint>(faces.size()),
+                [this](const uint begin, const uint end){
+                        compute_ensemble_coarse_fluxes(begin, end);
+                },
+                64
+        );
+        parallel::apply_to_subranges(0u, static_cast<uint>(cells.size()),
+                [this, &phi, &out, a, scaled_b, c, w](const uint begin, const uint end){
+                        compute_ensemble_cells(phi, out, a, scaled_b, c, w, begin, end);
+                },
+                16
+        );
+        phi.zero_out_ghosts();
 }
 
 /**
- * @brief Sets initial condition
+ * @brief Computes the numerical fluxes of all members for faces in @p [begin,end) wrt owner
  * 
- * Since nodal basis is being used, initial condition is easy to set. interpolate function of
- * VectorTools namespace is used with IC class and advection2D::g_solution. See IC::value()
+ * Any face with a flux is handled: the neighbor side value of a boundary face is given by the
+ * boundary conditions of the member in advection2D::ensemble_bcs, with the prescribed values of
+ * advection2D::ensemble_bc_values, and that of a hanging face is
+ * interpolated as in compute_hanging_fluxes(). The fluxes are stored in
+ * advection2D::ensemble_face_fluxes.
  */
-void advection2D::set_IC()
+void advection2D::compute_ensemble_fluxes(const state &phi, const uint begin, const uint end)
 {
-        VectorTools::interpolate(dof_handler, IC(), g_solution);
+        const uint dofs_per_face = fe_face.dofs_per_face, n = n_members;
+        AlignedVector<double> &phi_coarse = ensemble_face_work.get(); // coarse side values
+        if(phi_coarse.size() < dofs_per_face*n) phi_coarse.resize(dofs_per_face*n);
+        uint f, i, k, m, id;
+        double phi_owner, phi_neighbor;
+        for(f=begin; f<end; f++){
+                const face_info &cur_face = faces[f];
+                const bool hanging = cur_face.subface != numbers::invalid_unsigned_int;
+                if(hanging){
+                        for(k=0; k<dofs_per_face; k++){
+                                for(m=0; m<n; m++){
+                                        phi_coarse[k*n + m] = phi.local_element(
+                                                face_dof_ids_neighbor[f*dofs_per_face + k]*n + m);
+                                }
+                        }
+                }
+                for(i=0; i<dofs_per_face; i++){
+                        id = f*dofs_per_face + i;
+                        // the neighbor id is not valid for a boundary face, and not used
+                        const uint owner_id = face_dof_ids[id]*n,
+                                neighbor_id = face_dof_ids_neighbor[id]*n;
+                        double *flux = &ensemble_face_fluxes[id*n];
+                        for(m=0; m<n; m++){
+                                phi_owner = phi.local_element(owner_id + m);
+                                if(cur_face.at_boundary){
+                                        const uint b = cur_face.boundary_id;
+                                        phi_neighbor = (ensemble_bcs[m][b].type ==
+                                                bc_type::extrapolation) ? phi_owner :
+                                                ensemble_bc_values[b*n + m];
+                                }
+                                else if(hanging){
+                                        const std::vector<double> &interpolation =
+                                                subface_interpolation[cur_face.subface];
+                                        phi_neighbor = 0.0;
+                                        for(k=0; k<dofs_per_face; k++){
+                                                phi_neighbor += interpolation[i*dofs_per_face + k]*
+                                                        phi_coarse[k*n + m];
+                                        }
+                                }
+                                else phi_neighbor = phi.local_element(neighbor_id + m);
+                                flux[m] = rusanov_flux(phi_owner, phi_neighbor,
+                                        face_wind_normal[id], face_abs_wind_normal[id]);
+                        } // loop over members
+                } // loop over face dofs
+        } // loop over faces
 }
 
 /**
- * @brief Boundary ids are set here
+ * @brief Adds @p factor times a matrix product to the row major @p n_rows x @p n block @p y
  * 
- * @f$x=0@f$ forms boundary 0 with @f$\phi@f$ value prescribed as @f$1@f$<br/>
- * @f$y=0@f$ forms boundary 1 with @f$\phi@f$ value prescribed as @f$0@f$<br/>
- * @f$x=1 \bigcup y=1@f$ forms boundary 2 with zero gradient
- * @note Ghost cell approach will be used
- * @todo Check this function
+ * The matrix is made of the @p n_rows rows and the columns @p first + k @p increment,
+ * k < @p n_cols, of the row major matrix @p mat with row length @p ld. It multiplies the row major
+ * @p n_cols x @p n block @p x.
+ * 
+ * The columns of @p x and @p y are processed in blocks of 8, whose sums fit in registers. So
+ * @p mat is read once per block, i.e., once in all for up to 8 columns, while the rows of @p x in
+ * a block stay in L1 cache. The innermost loop is over the contiguous columns of a block, which
+ * the compiler vectorises. See add_matrix_product() for @p Number.
  */
-void advection2D::set_boundary_ids()
+template <typename Number>
+static void add_block_product(const uint n_rows, const uint n_cols, const uint ld,
+        const uint first, const uint increment, const Number *mat, const double factor,
+        const uint n, const double *x, double *y)
 {
-        for(auto &cell: dof_handler.active_cell_iterators()){
-                for(uint face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
-                        if(cell->face(face_id)->at_boundary()){
-                                Point<2> fcenter = cell->face(face_id)->center(); // face center
-                                if(fabs(fcenter(0)) < 1e-6)
-                                        cell->face(face_id)->set_boundary_id(0);
-                                else if(fabs(fcenter(1)) < 1e-6)
-                                        cell->face(face_id)->set_boundary_id(1);
-                                else
-                                        cell->face(face_id)->set_boundary_id(2);
+        constexpr uint block_size = 8;
+        std::array<double, block_size> sums;
+        uint block_begin, n_block_cols, r, k, j;
+        for(block_begin=0; block_begin<n; block_begin+=block_size){
+                n_block_cols = std::min(block_size, n - block_begin);
+                for(r=0; r<n_rows; r++){
+                        sums.fill(0.0);
+                        const Number *mat_row = mat + r*ld + first;
+                        for(k=0; k<n_cols; k++){
+                                const double mat_value = mat_row[k*increment];
+                                const double *x_row = x + k*n + block_begin;
+                                for(j=0; j<n_block_cols; j++) sums[j] += mat_value*x_row[j];
                         }
-                } // loop over faces
-        } // loop over cells
+                        double *y_row = y + r*n + block_begin;
+                        for(j=0; j<n_block_cols; j++) y_row[j] += factor*sums[j];
+                } // loop over rows
+        } // loop over column blocks
 }
 
 /**
- * @brief Updates solution with the given @p time_step
+ * @brief Computes the coarse side fluxes of all members for faces in @p [begin,end), like
+ * compute_coarse_fluxes()
  * 
- * Algorithm:
- * - For every cell:
- *   - For every face:
- *     - Get neighbor id
- *     - if neighbor id > cell id, continue
- *     - else:
- *       - Get face id wrt owner and neighbor (using neighbor_of_neighbor)
- *       - Get global dofs on owner and neighbor
- *       - Using face ids and global dofs of owner and neighbor, get global dofs on this face on
- * owner and neighbor side
- *       - Compute the numerical flux
- *       - Use lifting matrices to update owner and neighbor rhs
- * 
- * <code>cell->get_dof_indices()</code> will return the dof indices in the order shown in
- * https://www.dealii.org/current/doxygen/deal.II/classFE__DGQ.html. This fact is mentioned in
- * https://www.dealii.org/current/doxygen/deal.II/classDoFCellAccessor.html.
- * To get the dof location, advection2D::dof_locations has been obtained using
- * <code>DoFTools::map_dofs_to_support_points()</code>. To get normal vectors, an FEFaceValues
- * object is created with Gauss-Lobatto quadrature of order <code>fe.degree+1</code>.
- * 
- * The face normal flux vector must be mapped to owner- and neighbor- local dofs for multplication
- * with lifting matrices. The mapped vectors will be of size <code>dof_per_cell</code>.
+ * The projection is applied to the fluxes of all members at once with add_block_product().
+ */
+void advection2D::compute_ensemble_coarse_fluxes(const uint begin, const uint end)
+{
+        const uint dofs_per_face = fe_face.dofs_per_face, n = n_members;
+        uint f, subface, i;
+        for(f=begin; f<end; f++){
+                double *flux = &ensemble_face_fluxes[f*dofs_per_face*n];
+                for(i=0; i<dofs_per_face*n; i++) flux[i] = 0.0;
+                for(subface=0; subface<2; subface++){
+                        const uint fine_face = coarse_subfaces[f - n_flux_faces][subface];
+                        add_block_product(dofs_per_face, dofs_per_face, dofs_per_face, 0, 1,
+                                subface_projection[subface].data(), -1.0, n,
+                                &ensemble_face_fluxes[fine_face*dofs_per_face*n], flux);
+                }
+        } // loop over faces
+}
+
+/**
+ * @brief Adds the stiffness and lifting terms of all members of cell @p cell with the operator set
+ * @p op_set to the row major block @p rhs, see compute_ensemble_cells()
  * 
- * @pre @p time_step must be a stable one, any checks on this value are not done
- * @todo Some code repitition exists in the loop over faces
+ * @p phi is the block of the cell values. See add_matrix_product() for @p Number
  */
-void advection2D::update(const double time_step)
+template <typename Number>
+void advection2D::add_ensemble_products(const uint cell, const Number *op_set, const double *phi,
+        double *rhs) const
 {
-        // update old solution
-        uint i;
-        for(i=0; i<dof_handler.n_dofs(); i++) gold_solution(i) = g_solution(i);
-
-        // set rhs to zero
-        for(auto &cur_rhs: l_rhs) cur_rhs=0.0;
-
-        uint face_id, face_id_neighbor; // id of face wrt owner and neighbor
-        uint l_dof_id, l_dof_id_neighbor; // dof id (on a face) dof wrt owner and neighbor
-        // global dof ids of owner and neighbor
-        std::vector<uint> dof_ids(fe.dofs_per_cell), dof_ids_neighbor(fe.dofs_per_cell);
-        double phi, phi_neighbor; // owner and neighbor side values of phi
-        double cur_normal_flux; // normal flux at current dof
-        // the -ve of normal num flux vector of face wrt owner and neighbor
-        Vector<double> neg_normal_flux(fe.dofs_per_cell), neg_normal_flux_neighbor(fe.dofs_per_cell);
-        Point<2> dof_loc; // dof coordinates (on a face)
-        Tensor<1,2> normal; // face normal from away from owner at current dof
-        FEFaceValues<2> fe_face_values(fe, QGaussLobatto<1>(fe.degree+1), update_normal_vectors);
+        const uint dofs_per_cell = fe.dofs_per_cell, dofs_per_face = fe_face.dofs_per_face;
+        const uint n = n_members;
+        uint face_id, f, first_dof, dof_increment;
+        add_block_product(dofs_per_cell, dofs_per_cell, dofs_per_cell, 0, 1, op_set, 1.0, n, phi,
+                rhs);
+        for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                f = cell_faces[cell*GeometryInfo<2>::faces_per_cell + face_id];
+                get_face_dofs<-1>(face_id, first_dof, dof_increment);
+                add_block_product(dofs_per_cell, dofs_per_face, dofs_per_cell, first_dof,
+                        dof_increment, op_set + (face_id+1)*dofs_per_cell*dofs_per_cell,
+                        faces[f].owner == cell ? -1.0 : 1.0, n,
+                        &ensemble_face_fluxes[f*dofs_per_face*n], rhs);
+        }
+}
 
-        for(auto &cell: dof_handler.active_cell_iterators()){
-                cell->get_dof_indices(dof_ids);
-                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
-                        if(cell->face(face_id)->at_boundary()){
-                                // this face is part of boundary, set phi_neighbor appropriately
-                                fe_face_values.reinit(cell, face_id);
-                                for(i=0; i<fe_face.dofs_per_face; i++){
-                                        l_dof_id = face_first_dof[face_id] +
-                                                i*face_dof_increment[face_id];
-                                        
-                                        normal = fe_face_values.normal_vector(i);
-                                        // owner and neighbor side dof locations will match
-                                        dof_loc = dof_locations[
-                                                dof_ids[ l_dof_id ]
-                                        ];
-
-                                        phi = gold_solution[
-                                                dof_ids[ l_dof_id ]
-                                        ];
-                                        // use array of functions (or func ptrs) to set BC
-                                        phi_neighbor =
-                                                bc_fns[cell->face(face_id)->boundary_id()](phi);
-
-                                        cur_normal_flux = rusanov_flux(phi, phi_neighbor, dof_loc,
-                                                normal);
-                                        neg_normal_flux(l_dof_id) = -cur_normal_flux;
-                                } // loop over face dofs
-
-                                // multiply normal flux with lift matrx and store in rhs
-                                lift_mats[cell->index()][face_id].vmult_add(
-                                        l_rhs[cell->index()],
-                                        neg_normal_flux
-                                );
-                        }
-                        else if(cell->neighbor_index(face_id) > cell->index()) continue;
-                        else{
-                                // internal face
-                                fe_face_values.reinit(cell, face_id);
-                                face_id_neighbor = cell->neighbor_of_neighbor(face_id);
-                                cell->neighbor(face_id)->get_dof_indices(dof_ids_neighbor);
-                                for(i=0; i<fe_face.dofs_per_face; i++){
-                                        l_dof_id = face_first_dof[face_id] +
-                                                i*face_dof_increment[face_id];
-                                        l_dof_id_neighbor = face_first_dof[face_id_neighbor] +
-                                                i*face_dof_increment[face_id_neighbor];
-                                        
-                                        normal = fe_face_values.normal_vector(i);
-                                        // owner and neighbor side dof locations will match
-                                        dof_loc = dof_locations[
-                                                dof_ids[ l_dof_id ]
-                                        ];
-
-                                        phi = gold_solution[
-                                                dof_ids[ l_dof_id ]
-                                        ];
-                                        phi_neighbor = gold_solution[
-                                                dof_ids_neighbor[ l_dof_id_neighbor ]
-                                        ];
-
-                                        cur_normal_flux = rusanov_flux(phi, phi_neighbor, dof_loc,
-                                                normal);
-                                        neg_normal_flux(l_dof_id) = -cur_normal_flux;
-                                        neg_normal_flux_neighbor(l_dof_id_neighbor) = cur_normal_flux;
-                                } // loop over face dofs
-
-                                // multiply normal flux with lift matrx and store in rhs
-                                // for both owner and neighbor
-                                lift_mats[cell->neighbor_index(face_id)][face_id_neighbor].vmult_add(
-                                        l_rhs[cell->neighbor_index(face_id)],
-                                        neg_normal_flux_neighbor
-                                );
-                                lift_mats[cell->index()][face_id].vmult_add(
-                                        l_rhs[cell->index()],
-                                        neg_normal_flux
-                                );
-                        }
-                } // loop over faces
-                // compute stiffness term
-                Vector<double> lold_solution(fe.dofs_per_cell); // old phi values of cell
-                for(i=0; i<fe.dofs_per_cell; i++) lold_solution[i] = gold_solution[dof_ids[i]];
-                stiff_mats[cell->index()].vmult_add(
-                        l_rhs[cell->index()],
-                        lold_solution
-                );
-        } // loop over cells (for assembling rhs)
+/**
+ * @brief Computes rhs of all members for cells in @p [begin,end) and sets their entries of @p out,
+ * like compute_cells()
+ * 
+ * The cell values of the @f$N@f$ members form a row major @f$n \times N@f$ block (see
+ * set_ensemble()), and so do the face fluxes of a face. So the stiffness term of all members is a
+ * single product of the stiffness matrix with this block, and the lifting term of a face is a
+ * product of the face columns of its lifting matrix with the flux block. These are done by the
+ * cache blocked add_block_product(), which reads every operator of the cell once for up to 8
+ * members, see add_ensemble_products().
+ * 
+ * In operator_mode::sum_factorized, there are no matrices and the members are gathered one at a
+ * time into contiguous arrays for add_stiffness() and add_lifting().
+ */
+void advection2D::compute_ensemble_cells(const state &phi, state &out, const double a,
+        const double b, const double c, const state *w, const uint begin, const uint end)
+{
+        const uint dofs_per_cell = fe.dofs_per_cell, dofs_per_face = fe_face.dofs_per_face;
+        const uint n = n_members, block_size = dofs_per_cell*n;
+        const bool sum_factorized = op_mode == operator_mode::sum_factorized;
+        // rhs of all members, then the values, rhs and face flux of a member and the scratch of
+        // add_stiffness() for sum factorization
+        const uint work_size = block_size +
+                (sum_factorized ? 2*dofs_per_cell + dofs_per_face + sf.n_work() : 0);
+        AlignedVector<double> &work = cell_work.get();
+        if(work.size() < work_size) work.resize(work_size);
+        double *cur_rhs = work.data();
+        double *member_phi = cur_rhs + block_size, *member_rhs = member_phi + dofs_per_cell,
+                *member_flux = member_rhs + dofs_per_cell, *sf_work = member_flux + dofs_per_face;
+        const double *phi_ptr = phi.begin();
+        const double *w_ptr = (w == nullptr) ? nullptr : w->begin();
+        double *out_ptr = out.begin();
+        uint cell, face_id, f, i, k, m;
+        for(cell=begin; cell<end; cell++){
+                const uint offset = cell*block_size;
+                for(i=0; i<block_size; i++) cur_rhs[i] = 0.0;
+                if(sum_factorized){
+                        for(m=0; m<n; m++){
+                                for(i=0; i<dofs_per_cell; i++){
+                                        member_phi[i] = phi_ptr[offset + i*n + m];
+                                        member_rhs[i] = 0.0;
+                                }
+                                add_stiffness<-1>(cell, member_phi, member_rhs, sf_work);
+                                for(face_id=0; face_id<GeometryInfo<2>::faces_per_cell; face_id++){
+                                        f = cell_faces[cell*GeometryInfo<2>::faces_per_cell +
+                                                face_id];
+                                        const double *flux =
+                                                &ensemble_face_fluxes[f*dofs_per_face*n];
+                                        for(k=0; k<dofs_per_face; k++){
+                                                member_flux[k] = flux[k*n + m];
+                                        }
+                                        add_lifting<-1>(cell, face_id, member_flux,
+                                                faces[f].owner == cell ? -1.0 : 1.0, member_rhs);
+                                }
+                                for(i=0; i<dofs_per_cell; i++) cur_rhs[i*n + m] = member_rhs[i];
+                        } // loop over members
+                }
+                else if(op_data_float != nullptr){
+                        add_ensemble_products(cell, op_data_float +
+                                std::size_t(cell_op_ids[cell])*op_block_size(), phi_ptr + offset,
+                                cur_rhs);
+                }
+                else{
+                        add_ensemble_products(cell, op_data +
+                                std::size_t(cell_op_ids[cell])*op_block_size(), phi_ptr + offset,
+                                cur_rhs);
+                }
 
-        // Now, update
-        for(auto &cell: dof_handler.active_cell_iterators()){
-                cell->get_dof_indices(dof_ids);
-                for(i=0; i<fe.dofs_per_cell; i++){
-                        g_solution[dof_ids[i]] = gold_solution[dof_ids[i]] +
-                                l_rhs[cell->index()][i] * time_step;
+                const double scaled_b = cell_op_scales[cell]*b;
+                for(i=0; i<block_size; i++){
+                        out_ptr[offset + i] = a*phi_ptr[offset + i] + scaled_b*cur_rhs[i] +
+                                (w_ptr == nullptr ? 0.0 : c*w_ptr[offset + i]);
                 }
+        } // loop over cells
+}
+
+/**
+ * @brief Limits the number of threads used by update()
+ * 
+ * This calls <code>MultithreadInfo::set_thread_limit()</code> and hence applies to all the deal.II
+ * threaded functions. Without a limit, deal.II uses all available cores or the value of the
+ * environment variable <code>DEAL_II_NUM_THREADS</code>.
+ */
+void advection2D::set_n_threads(const uint n_threads)
+{
+        MultithreadInfo::set_thread_limit(n_threads);
+        deallog << "Using " << MultithreadInfo::n_threads() << " thread(s)" << std::endl;
+}
+
+/**
+ * @brief Adds lifting term of face @p face_id of cell @p c, multiplied by @p factor, to the cell
+ * rhs
+ * 
+ * A lifting matrix has non-zero columns only for the dofs on its face. So only these columns are
+ * multiplied with @p flux instead of doing a dense matrix-vector product, see add_face_product().
+ * The matrices are those of advection2D::op_data_float if it is not null, else those of
+ * advection2D::op_data. In operator_mode::sum_factorized, sum_factorization::apply_lifting() is
+ * used.
+ * 
+ * For @p degree > 0, sizes and face dof tables are taken from dof_tables, else at runtime
+ * 
+ * @param[in] c The cell index
+ * @param[in] face_id Face id wrt the cell
+ * @param[in] flux The normal numerical flux, in face dof order
+ * @param[in] factor The factor, -1 if @p flux is wrt cell @p c, else +1
+ * @param[in,out] rhs The cell rhs
+ */
+template <int degree>
+void advection2D::add_lifting(const uint c, const uint face_id, const double *flux,
+        const double factor, double *rhs) const
+{
+        if(op_mode == operator_mode::sum_factorized){
+                sf.apply_lifting<(degree > 0) ? degree+1 : 0>(face_id, flux,
+                        factor*sf_inv_sizes[2*c + face_id/2], rhs);
+                return;
+        }
+        const uint dofs_per_cell = (degree > 0) ? (degree+1)*(degree+1) : fe.dofs_per_cell;
+        const uint dofs_per_face = (degree > 0) ? degree+1 : fe_face.dofs_per_face;
+        uint first_dof, dof_increment;
+        get_face_dofs<degree>(face_id, first_dof, dof_increment);
+        const std::size_t offset = std::size_t(cell_op_ids[c])*op_block_size() +
+                (face_id+1)*dofs_per_cell*dofs_per_cell;
+        if(op_data_float != nullptr){
+                add_face_product(dofs_per_cell, dofs_per_face, first_dof, dof_increment,
+                        op_data_float + offset, flux, factor, rhs);
+        }
+        else{
+                add_face_product(dofs_per_cell, dofs_per_face, first_dof, dof_increment,
+                        op_data + offset, flux, factor, rhs);
+        }
+}
+
+/**
+ * @brief Gets the first cell dof and the cell dof increment of face @p face_id
+ * 
+ * From dof_tables for @p degree > 0, else from advection2D::face_first_dof and
+ * advection2D::face_dof_increment
+ */
+template <int degree>
+void advection2D::get_face_dofs(const uint face_id, uint &first_dof, uint &dof_increment) const
+{
+        if constexpr(degree > 0){
+                first_dof = dof_tables<degree>::face_first_dof[face_id];
+                dof_increment = dof_tables<degree>::face_dof_increment[face_id];
+        }
+        else{
+                first_dof = face_first_dof[face_id];
+                dof_increment = face_dof_increment[face_id];
+        }
+}
+
+/**
+ * @brief Adds stiffness term of cell @p c to the cell rhs
+ * 
+ * @param[in] c The cell index
+ * @param[in] phi Cell dof values
+ * @param[in,out] rhs The cell rhs
+ * @param work Work array of size sum_factorization::n_work(), used only in
+ * operator_mode::sum_factorized
+ * 
+ * See add_lifting() for @p degree
+ */
+template <int degree>
+void advection2D::add_stiffness(const uint c, const double *phi, double *rhs, double *work) const
+{
+        const uint dofs_per_cell = (degree > 0) ? (degree+1)*(degree+1) : fe.dofs_per_cell;
+        if(op_mode == operator_mode::sum_factorized){
+                // number of quad points equals number of dofs
+                sf.apply_stiffness<(degree > 0) ? degree+1 : 0>(phi, &sf_coeffs[2*dofs_per_cell*c],
+                        &sf_coeffs[2*dofs_per_cell*c + dofs_per_cell], rhs, work);
+                return;
         }
+        const std::size_t offset = std::size_t(cell_op_ids[c])*op_block_size();
+        if(op_data_float != nullptr){
+                add_matrix_product(dofs_per_cell, op_data_float + offset, phi, rhs);
+        }
+        else add_matrix_product(dofs_per_cell, op_data + offset, phi, rhs);
 }
 
 /**
  * @brief Prints stifness and the 4 lifting matrices of 0-th element
+ * 
+ * In operator_mode::shared, the printed matrices are to be scaled by advection2D::cell_op_scales
  */
 void advection2D::print_matrices() const
 {
+        if(op_mode == operator_mode::sum_factorized){
+                deallog << "No matrices stored with sum factorization" << std::endl;
+                return;
+        }
+        if(n_ops == 0) return;
+        const uint n = fe.dofs_per_cell;
         deallog << "Stiffness matrix" << std::endl;
-        stiff_mats[0].print(deallog, 10, 2);
+        FullMatrix<double>(n, n, op_data).print(deallog, 10, 2);
         for(uint i=0; i<GeometryInfo<2>::faces_per_cell; i++){
                 deallog << "Lifting matrix, face " << i << std::endl;
-                lift_mats[0][i].print(deallog, 15, 4);
+                FullMatrix<double>(n, n, op_data + (i+1)*n*n).print(deallog, 15, 4);
+        }
+}
+
+/**
+ * @brief Returns the bytes allocated by @p vec
+ */
+template <typename T>
+static std::size_t vector_memory(const std::vector<T> &vec)
+{
+        return vec.capacity()*sizeof(T);
+}
+
+/**
+ * @brief Returns the memory used by the mesh, dofs, solution vectors, operators and face data of
+ * this process, in bytes
+ * 
+ * A mapped operator cache file is included with its full size, though its pages are shared with
+ * the page cache.
+ */
+std::size_t advection2D::memory_consumption() const
+{
+        return triang.memory_consumption() + dof_handler.memory_consumption() +
+                g_solution.memory_consumption() + gold_solution.memory_consumption() +
+                op_storage.memory_consumption() + op_storage_float.memory_consumption() +
+                op_map_size +
+                vector_memory(cell_op_ids) + vector_memory(cell_op_scales) +
+                vector_memory(sf_coeffs) + vector_memory(sf_inv_sizes) +
+                vector_memory(faces) + vector_memory(face_owner_cells) +
+                vector_memory(face_dof_ids) + vector_memory(face_dof_ids_neighbor) +
+                vector_memory(cell_faces) + vector_memory(coarse_subfaces) +
+                vector_memory(face_normals) + vector_memory(face_points) +
+                vector_memory(face_wind_normal) + vector_memory(face_abs_wind_normal) +
+                vector_memory(face_fluxes) + vector_memory(cells) + vector_memory(cell_time_steps) +
+                ensemble_solution.memory_consumption() +
+                ensemble_old_solution.memory_consumption() +
+                vector_memory(ensemble_face_fluxes) +
+                vector_memory(cell_levels) + vector_memory(face_levels) +
+                vector_memory(face_flux_sums);
+}
+
+/**
+ * @brief Outputs the global solution at @p time in compressed vtu format, taking the base name and
+ * output counter as args
+ * 
+ * The solution is copied and written in the background by advection2D::writer, so the files may
+ * not be complete on return. The file names, the pvtu record written with more than one MPI process
+ * and the pvd time series are described in output_writer.
+ */
+void advection2D::output(const std::string &base_name, const uint counter, const double time)
+{
+        download_from_device();
+        writer.write(g_solution, base_name, counter, time);
+}
+
+
+
+/**
+ * @brief Saves a checkpoint with base name @p base_name, optionally with the operators
+ * 
+ * The triangulation is saved to @p base_name.mesh, using p4est with a distributed triangulation
+ * and boost serialization otherwise. Every process writes a raw binary file
+ * @p base_name.rank.bin (rank zero padded to 4 digits) with:
+ * 1. A header: format version, degree, number of processes, advection2D::op_mode, number of
+ * owned cells and dofs, advection2D::cur_time, advection2D::time_counter, whether operators
+ * are saved and advection2D::ordering, followed by advection2D::diag_initial_mass
+ * 2. The owned entries of advection2D::g_solution, in their local (cell wise) order
+ * 3. If @p save_operators is true, advection2D::cell_op_ids, advection2D::cell_op_scales, the
+ * stored stiffness and lifting matrices and the sum factorization data. Then load_checkpoint()
+ * need not call assemble_system()
+ * 
+ * Since the owned cells of a process and their order are recovered exactly on loading with the
+ * same number of processes, no index data is saved.
+ */
+void advection2D::save_checkpoint(const std::string &base_name, const bool save_operators) const
+{
+        #ifdef DEAL_II_WITH_P4EST
+        triang.save(base_name + ".mesh");
+        #else
+        {
+                std::ofstream mesh_file(base_name + ".mesh", std::ios::binary);
+                boost::archive::binary_oarchive mesh_archive(mesh_file);
+                triang.save(mesh_archive, 0);
+        }
+        #endif
+
+        const uint rank = Utilities::MPI::this_mpi_process(mpi_comm);
+        std::ofstream ofile(base_name + "." + Utilities::int_to_string(rank, 4) + ".bin",
+                std::ios::binary);
+        const std::array<uint, 9> header = {checkpoint_version, fe.degree,
+                Utilities::MPI::n_mpi_processes(mpi_comm), static_cast<uint>(op_mode),
+                static_cast<uint>(cells.size()), g_solution.local_size(), time_counter,
+                save_operators, static_cast<uint>(ordering)};
+        write_raw(ofile, header.data(), header.size());
+        write_raw(ofile, &cur_time, 1);
+        write_raw(ofile, &diag_initial_mass, 1);
+        write_raw(ofile, g_solution.begin(), g_solution.local_size());
+        if(save_operators){
+                write_raw(ofile, &n_ops, 1);
+                write_raw(ofile, cell_op_ids.data(), cell_op_ids.size());
+                write_raw(ofile, cell_op_scales.data(), cell_op_scales.size());
+                write_raw(ofile, op_data, std::size_t(n_ops)*op_block_size());
+                write_raw(ofile, sf_coeffs.data(), sf_coeffs.size());
+                write_raw(ofile, sf_inv_sizes.data(), sf_inv_sizes.size());
+        }
+        AssertThrow(ofile, ExcMessage("Could not write checkpoint " + base_name));
+        deallog << "Checkpoint saved: " << base_name << " at step " << time_counter << std::endl;
+}
+
+/**
+ * @brief Restarts from the checkpoint with base name @p base_name, written by save_checkpoint()
+ * 
+ * This replaces setup_system(), assemble_system() and set_IC(). The mesh is loaded in place of the
+ * one generated in setup_system() and the dofs and face data are set up on it. If the checkpoint
+ * has operators, only the face geometry is computed (see assemble_face_geometry()) and the
+ * operators are read. Otherwise assemble_system() is called.
+ * 
+ * @pre The checkpoint must be written with the same degree, operator mode and number of processes
+ */
+void advection2D::load_checkpoint(const std::string &base_name)
+{
+        deallog << "Loading checkpoint " << base_name << std::endl;
+        #ifdef DEAL_II_WITH_P4EST
+        // p4est needs the coarse mesh
+        GridGenerator::hyper_cube(triang);
+        triang.load(base_name + ".mesh");
+        #else
+        {
+                std::ifstream mesh_file(base_name + ".mesh", std::ios::binary);
+                AssertThrow(mesh_file, ExcMessage("Could not open " + base_name + ".mesh"));
+                boost::archive::binary_iarchive mesh_archive(mesh_file);
+                triang.load(mesh_archive, 0);
+        }
+        #endif
+        setup_dofs();
+
+        const uint rank = Utilities::MPI::this_mpi_process(mpi_comm);
+        const std::string filename = base_name + "." + Utilities::int_to_string(rank, 4) + ".bin";
+        std::ifstream ifile(filename, std::ios::binary);
+        AssertThrow(ifile, ExcMessage("Could not open " + filename));
+        std::array<uint, 9> header;
+        read_raw(ifile, header.data(), header.size());
+        AssertThrow(header[0] == checkpoint_version, ExcMessage("Unknown checkpoint version"));
+        AssertThrow(header[1] == fe.degree, ExcMessage("Checkpoint degree differs"));
+        AssertThrow(header[2] == Utilities::MPI::n_mpi_processes(mpi_comm),
+                ExcMessage("Checkpoint number of processes differs"));
+        AssertThrow(header[3] == static_cast<uint>(op_mode),
+                ExcMessage("Checkpoint operator mode differs"));
+        AssertThrow(header[4] == cells.size() && header[5] == g_solution.local_size(),
+                ExcMessage("Checkpoint partition differs"));
+        AssertThrow(header[8] == static_cast<uint>(ordering),
+                ExcMessage("Checkpoint cell ordering differs"));
+        time_counter = header[6];
+        read_raw(ifile, &cur_time, 1);
+        read_raw(ifile, &diag_initial_mass, 1);
+        read_raw(ifile, g_solution.begin(), g_solution.local_size());
+
+        if(!header[7]){
+                assemble_system();
+                return;
+        }
+        assemble_face_geometry();
+        unmap_operators();
+        read_raw(ifile, &n_ops, 1);
+        cell_op_ids.resize(cells.size());
+        cell_op_scales.resize(cells.size());
+        read_raw(ifile, cell_op_ids.data(), cell_op_ids.size());
+        read_raw(ifile, cell_op_scales.data(), cell_op_scales.size());
+        op_storage.resize(std::size_t(n_ops)*op_block_size());
+        read_raw(ifile, op_storage.data(), op_storage.size());
+        op_data = op_storage.data();
+        convert_operators();
+        if(op_mode == operator_mode::sum_factorized){
+                sf_coeffs.resize(2*sf.n*sf.n*cells.size());
+                sf_inv_sizes.resize(2*cells.size());
+                read_raw(ifile, sf_coeffs.data(), sf_coeffs.size());
+                read_raw(ifile, sf_inv_sizes.data(), sf_inv_sizes.size());
+                // saved at the last stage time, the face geometry is at advection2D::cur_time
+                if(wind_fn.dependence == wind_dependence::general) assemble_sum_factorized();
+        }
+        deallog << "Restarted at step " << time_counter << " time " << cur_time << " with " <<
+                n_ops << " stored operator set(s)" << std::endl;
+}
+
+
+
+// # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
+// Driver functions
+// # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
+/**
+ * @brief Declares the parameters read by run()
+ * 
+ * Subsections "Discretization" (order, refinements, operator mode), "Time stepping" (end time,
+ * Courant number, integrator), "Adaptivity" (see set_adaptivity()), "Diagnostics" (see
+ * set_diagnostics()), "Output" (base name, output intervals, checkpoint interval and restart) and
+ * the entries "threads" and "operator cache" at the top level.
+ */
+void advection2D::declare_parameters(ParameterHandler &prm)
+{
+        prm.declare_entry("threads", "0", Patterns::Integer(0),
+                "Max number of threads, 0 for no limit (see advection2D::set_n_threads())");
+        prm.declare_entry("operator cache", "", Patterns::Anything(),
+                "Existing directory of the operator cache, empty to disable it");
+
+        prm.enter_subsection("Discretization");
+        prm.declare_entry("order", "1", Patterns::Integer(1), "Polynomial order");
+        prm.declare_entry("refinements", "5", Patterns::Integer(0),
+                "Number of global refinements of the unit square");
+        prm.declare_entry("operator mode", "shared",
+                Patterns::Selection("per_cell|shared|sum_factorized"),
+                "Storage of stiffness and lifting operators");
+        prm.declare_entry("cell ordering", "hilbert",
+                Patterns::Selection("hierarchy|morton|hilbert"),
+                "Order of cells, dofs and operators (see advection2D::order_cells())");
+        prm.declare_entry("float operators", "false", Patterns::Bool(),
+                "Store the matrices in single precision (see advection2D::set_float_operators())");
+        prm.declare_entry("float operator tolerance", "1e-5", Patterns::Double(0),
+                "Max relative rhs error of single precision matrices, else double ones are used");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Time stepping");
+        prm.declare_entry("end time", "0.5", Patterns::Double(0), "End time");
+        prm.declare_entry("courant", "0.5", Patterns::Double(0),
+                "Courant number of the time step, see advection2D::stable_time_step()");
+        prm.declare_entry("integrator", "ssprk3",
+                Patterns::Selection("forward_euler|ssprk3|lsrk45|lts_forward_euler"),
+                "Time integration scheme");
+        prm.declare_entry("device", "false", Patterns::Bool(),
+                "Run the time loop on a CUDA device (see advection2D::set_device())");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Adaptivity");
+        prm.declare_entry("interval", "0", Patterns::Integer(0),
+                "Adapt the mesh every these many steps, 0 to disable");
+        prm.declare_entry("refine fraction", "0.3", Patterns::Double(0, 1),
+                "Fraction of the total indicator in cells to be refined");
+        prm.declare_entry("coarsen fraction", "0.05", Patterns::Double(0, 1),
+                "Fraction of the total indicator in cells to be coarsened");
+        prm.declare_entry("min level", "3", Patterns::Integer(0), "Min refinement level");
+        prm.declare_entry("max level", "7", Patterns::Integer(0), "Max refinement level");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Ensemble");
+        prm.declare_entry("members", "0", Patterns::Integer(0),
+                "Number of ensemble members, 0 for a single run (see advection2D::set_ensemble())");
+        prm.declare_entry("IC scales", "", Patterns::List(Patterns::Double()),
+                "Scaling of the initial condition of every member, empty for 1");
+        prm.declare_entry("boundary 0 values", "", Patterns::List(Patterns::Double()),
+                "Inflow value of boundary 0 of every member, empty for the default");
+        prm.declare_entry("boundary 1 values", "", Patterns::List(Patterns::Double()),
+                "Inflow value of boundary 1 of every member, empty for the default");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Diagnostics");
+        prm.declare_entry("interval", "0", Patterns::Integer(0),
+                "Report mass, extrema and error every these many steps, 0 to disable "
+                "(see advection2D::set_diagnostics())");
+        prm.declare_entry("exact solution", "", Patterns::Anything(),
+                "Exact solution in x, y and t for the L2 error, empty if not known");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Output");
+        prm.declare_entry("base name", "output", Patterns::Anything(),
+                "Base name of output files, see output_writer");
+        prm.declare_entry("interval", "10", Patterns::Integer(0),
+                "Output every these many steps, 0 for only the start and end");
+        prm.declare_entry("time interval", "0", Patterns::Double(0),
+                "Output interval in simulation time, overrides \"interval\" if positive");
+        prm.declare_entry("checkpoint interval", "0", Patterns::Integer(0),
+                "Checkpoint every these many steps, 0 to disable");
+        prm.declare_entry("restart", "", Patterns::Anything(),
+                "Base name of the checkpoint to restart from, empty to start from initial condition");
+        prm.declare_entry("trace", "false", Patterns::Bool(),
+                "Write the trace of the operator phases (see advection2D::set_trace())");
+        prm.leave_subsection();
+}
+
+/**
+ * @brief Runs a simulation with parameters in @p prm, declared by declare_parameters()
+ * 
+ * The problem is set up and assembled and the initial condition set, or restarted from a
+ * checkpoint. Single precision operators, if enabled, are then checked by check_float_operators(),
+ * and the problem is advanced to the end time with time_loop(). Unlike test(), this is available
+ * in release builds.
+ * 
+ * If the number of ensemble members is positive, an ensemble sweeping the initial condition scale
+ * and the inflow values of boundaries 0 and 1 is advanced with ensemble_time_loop() instead.
+ */
+void advection2D::run(ParameterHandler &prm)
+{
+        const uint n_threads = prm.get_integer("threads");
+        if(n_threads > 0) set_n_threads(n_threads);
+        const std::string op_cache_dir = prm.get("operator cache");
+
+        prm.enter_subsection("Discretization");
+        const uint order = prm.get_integer("order");
+        const uint n_refinements = prm.get_integer("refinements");
+        const std::string mode_name = prm.get("operator mode");
+        const std::string ordering_name = prm.get("cell ordering");
+        const bool float_operators = prm.get_bool("float operators");
+        const double float_tolerance = prm.get_double("float operator tolerance");
+        prm.leave_subsection();
+        operator_mode op_mode = operator_mode::shared;
+        if(mode_name == "per_cell") op_mode = operator_mode::per_cell;
+        else if(mode_name == "sum_factorized") op_mode = operator_mode::sum_factorized;
+
+        prm.enter_subsection("Time stepping");
+        const double end_time = prm.get_double("end time");
+        const double courant = prm.get_double("courant");
+        const std::string integrator_name = prm.get("integrator");
+        const bool use_device = prm.get_bool("device");
+        prm.leave_subsection();
+        // Patterns::Double has no exclusive bound, a zero step would never reach the end time
+        AssertThrow(courant > 0, ExcMessage("The Courant number must be positive"));
+        time_integrator integrator = time_integrator::ssprk3;
+        if(integrator_name == "forward_euler") integrator = time_integrator::forward_euler;
+        else if(integrator_name == "lsrk45") integrator = time_integrator::lsrk45;
+        else if(integrator_name == "lts_forward_euler"){
+                integrator = time_integrator::lts_forward_euler;
+        }
+
+        prm.enter_subsection("Adaptivity");
+        const uint adapt_interval = prm.get_integer("interval");
+        const double refine_fraction = prm.get_double("refine fraction");
+        const double coarsen_fraction = prm.get_double("coarsen fraction");
+        const uint min_level = prm.get_integer("min level");
+        const uint max_level = prm.get_integer("max level");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Ensemble");
+        const uint n_members = prm.get_integer("members");
+        auto get_list = [&prm](const std::string &name){
+                return Utilities::string_to_double(Utilities::split_string_list(prm.get(name)));
+        };
+        const std::vector<double> ic_scales = get_list("IC scales");
+        const std::array<std::vector<double>, 2> boundary_values = {
+                get_list("boundary 0 values"), get_list("boundary 1 values")
+        };
+        prm.leave_subsection();
+
+        prm.enter_subsection("Diagnostics");
+        const uint diag_interval = prm.get_integer("interval");
+        const std::string exact_expression = prm.get("exact solution");
+        prm.leave_subsection();
+
+        prm.enter_subsection("Output");
+        const std::string base_name = prm.get("base name");
+        const uint output_interval = prm.get_integer("interval");
+        const double output_time_interval = prm.get_double("time interval");
+        const uint checkpoint_interval = prm.get_integer("checkpoint interval");
+        const std::string restart_name = prm.get("restart");
+        const bool trace = prm.get_bool("trace");
+        prm.leave_subsection();
+
+        advection2D problem(order, op_mode, integrator);
+        problem.set_operator_cache(op_cache_dir);
+        problem.set_adaptivity(adapt_interval, refine_fraction, coarsen_fraction, min_level,
+                max_level);
+        problem.set_device(use_device);
+        problem.set_trace(trace);
+        if(ordering_name == "hierarchy") problem.set_cell_ordering(cell_ordering::hierarchy);
+        else if(ordering_name == "morton") problem.set_cell_ordering(cell_ordering::morton);
+        problem.set_float_operators(float_operators, float_tolerance);
+        std::function<double(const Point<2>&, const double)> exact;
+        if(!exact_expression.empty()){
+                // time as the third coordinate, so that concurrent calls share no state
+                auto parser = std::make_shared<FunctionParser<3>>();
+                parser->initialize("x,y,t", exact_expression, std::map<std::string, double>());
+                exact = [parser](const Point<2> &p, const double t){
+                        return parser->value(Point<3>(p[0], p[1], t));
+                };
+        }
+        problem.set_diagnostics(diag_interval, exact);
+        if(n_members > 0){
+                AssertThrow(restart_name.empty() && adapt_interval == 0,
+                        ExcMessage("Ensembles support neither restart nor mesh adaptation"));
+                AssertThrow(ic_scales.empty() || ic_scales.size() == n_members,
+                        ExcMessage("Give an IC scale for every member"));
+                std::vector<std::function<double(const Point<2>&)>> ICs;
+                std::vector<bc_set> member_bcs;
+                for(uint m=0; m<n_members; m++){
+                        const double scale = ic_scales.empty() ? 1.0 : ic_scales[m];
+                        ICs.emplace_back([scale](const Point<2> &p){ return scale*IC().value(p); });
+                        bc_set bcs = problem.bcs;
+                        for(uint b=0; b<boundary_values.size(); b++){
+                                if(boundary_values[b].empty()) continue;
+                                AssertThrow(boundary_values[b].size() == n_members,
+                                        ExcMessage("Give a boundary value for every member"));
+                                bcs[b] = boundary_condition::dirichlet(boundary_values[b][m]);
+                        }
+                        member_bcs.emplace_back(bcs);
+                }
+                problem.setup_system(n_refinements);
+                problem.assemble_system();
+                // the precision check uses the initial condition of a single run
+                problem.set_IC();
+                problem.check_float_operators();
+                problem.set_ensemble(ICs, member_bcs);
+                problem.ensemble_time_loop(end_time, courant, base_name, output_interval);
+                return;
         }
+        if(restart_name.empty()){
+                problem.setup_system(n_refinements);
+                problem.assemble_system();
+                problem.set_IC();
+        }
+        else problem.load_checkpoint(restart_name);
+        problem.check_float_operators();
+        deallog << "Stable time step: " << problem.stable_time_step(courant) << std::endl;
+        problem.time_loop(end_time, courant, base_name, output_interval, output_time_interval,
+                checkpoint_interval);
+}
+
+
+
+// # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
+// Benchmark function
+// # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # #
+/**
+ * @brief Opens a counter of the hardware cache misses of the calling thread, disabled, and returns
+ * its file descriptor
+ * 
+ * Returns -1 if the counter is not available, i.e., not on linux or if not permitted by
+ * <code>/proc/sys/kernel/perf_event_paranoid</code>
+ */
+static int open_cache_miss_counter()
+{
+        #ifdef __linux__
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        #else
+        return -1;
+        #endif
+}
+
+/**
+ * @brief Resets and enables the counter @p fd of open_cache_miss_counter(), if it is open
+ */
+static void start_cache_miss_counter(const int fd)
+{
+        #ifdef __linux__
+        if(fd < 0) return;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        #endif
+}
+
+/**
+ * @brief Disables the counter @p fd of open_cache_miss_counter() and returns its count, -1 if it
+ * is not open
+ */
+static long long stop_cache_miss_counter(const int fd)
+{
+        long long count = -1;
+        #ifdef __linux__
+        if(fd < 0) return count;
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(fd, &count, sizeof(count)) != sizeof(count)) count = -1;
+        #endif
+        return count;
 }
 
 /**
- * @brief Outputs the global solution in vtk format taking the filename as argument
+ * @brief Times setup, assembly, update and output for every combination of @p orders,
+ * @p refinements and @p orderings
+ * 
+ * For every case, a problem with @p op_mode, @p integrator and the cell ordering of the case (see
+ * order_cells()) is set up, assembled and @p n_steps
+ * updates are done with the stable time step at Courant number 0.5, followed by one output. The
+ * phases are timed with <code>TimerOutput</code> sections "setup", "assemble", "update" and
+ * "output". The output phase includes waiting for the background writer. Apart from the wall
+ * times, the following are reported:
+ * - Dofs per second per rhs evaluation: number of dofs times number of rhs evaluations divided by
+ * update time
+ * - Memory: sum of memory_consumption() over all processes and max peak resident set size of a
+ * process
+ * - Cache misses: the hardware cache misses of the update phase counted by
+ * <code>perf_event_open</code>, summed over all processes, or -1 if the counter is not available.
+ * Only the misses of the main thread of a process are counted, so run with one thread (see
+ * set_n_threads()) to count all of them. Comparing the orderings shows the effect of the cell
+ * order on the locality of the face and cell loops.
+ * - Operator error: with @p float_operators, the matrices are stored in single precision (see
+ * set_float_operators()) and this is the relative rhs error of check_float_operators(), else 0.
+ * If it is above the default tolerance, the case runs with double matrices.
+ * 
+ * The root process writes the results to @p base_name.csv and @p base_name.json and logs a line
+ * per case. The output files of the cases are written with base name @p base_name_output.
  */
-void advection2D::output(const std::string &filename) const
+void advection2D::benchmark(const std::vector<uint> &orders, const std::vector<uint> &refinements,
+        const uint n_steps, const operator_mode op_mode, const time_integrator integrator,
+        const std::vector<cell_ordering> &orderings, const bool float_operators,
+        const std::string &base_name)
 {
-        DataOut<2> data_out;
-        data_out.attach_dof_handler(dof_handler);
-        data_out.add_data_vector(g_solution, "phi");
+        const MPI_Comm mpi_comm = MPI_COMM_WORLD;
+        const bool is_root = Utilities::MPI::this_mpi_process(mpi_comm) == 0;
+        const uint n_processes = Utilities::MPI::n_mpi_processes(mpi_comm);
+        const std::array<std::string, 4> phases = {"setup", "assemble", "update", "output"};
+        static const std::array<std::string, 3> ordering_names = {"hierarchy", "morton", "hilbert"};
+        std::ofstream csv_file, json_file;
+        if(is_root){
+                csv_file.open(base_name + ".csv");
+                json_file.open(base_name + ".json");
+                csv_file << "order,refinements,ordering,n_cells,n_dofs,n_processes,n_threads," <<
+                        "n_steps,setup,assemble,update,output,dofs_per_second,memory,peak_rss," <<
+                        "cache_misses,float_operators,operator_error\n";
+                json_file << "[";
+        }
+
+        // every combination of order, refinements and cell ordering
+        std::vector<std::tuple<uint, uint, cell_ordering>> cases;
+        for(const uint order: orders){
+                for(const uint n_refinements: refinements){
+                        for(const cell_ordering cur_ordering: orderings){
+                                cases.emplace_back(order, n_refinements, cur_ordering);
+                        }
+                }
+        }
+
+        const int miss_counter = open_cache_miss_counter();
+        bool first_case = true;
+        for(const auto &[order, n_refinements, cur_ordering]: cases){
+                const std::string &ordering_name = ordering_names[static_cast<uint>(cur_ordering)];
+                std::ostringstream timer_stream; // summary is not printed
+                TimerOutput timer(mpi_comm, timer_stream, TimerOutput::never,
+                        TimerOutput::wall_times);
+                advection2D problem(order, op_mode, integrator);
+                problem.set_cell_ordering(cur_ordering);
+                problem.set_float_operators(float_operators);
+                {
+                        TimerOutput::Scope scope(timer, "setup");
+                        problem.setup_system(n_refinements);
+                }
+                {
+                        TimerOutput::Scope scope(timer, "assemble");
+                        problem.assemble_system();
+                }
+                problem.set_IC();
+                const double operator_error = problem.check_float_operators();
+                const double time_step = problem.stable_time_step(0.5);
+                {
+                        TimerOutput::Scope scope(timer, "update");
+                        start_cache_miss_counter(miss_counter);
+                        for(uint i=0; i<n_steps; i++) problem.update(time_step);
+                }
+                const long long local_misses = stop_cache_miss_counter(miss_counter);
+                // -1 if the counter is not available on any process
+                const long long cache_misses = (Utilities::MPI::min(local_misses, mpi_comm) < 0) ?
+                        -1 : Utilities::MPI::sum(local_misses, mpi_comm);
+                {
+                        TimerOutput::Scope scope(timer, "output");
+                        problem.output(base_name + "_output", n_steps, n_steps*time_step);
+                        problem.writer.flush();
+                }
+
+                std::map<std::string, double> times =
+                        timer.get_summary_data(TimerOutput::total_wall_time);
+                const double n_dofs = problem.dof_handler.n_dofs();
+                const double dofs_per_second = times["update"] > 0 ?
+                        n_dofs*n_steps*problem.n_rhs_evaluations()/times["update"] : 0.0;
+                const std::size_t memory = Utilities::MPI::sum(problem.memory_consumption(),
+                        mpi_comm);
+                struct rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                // ru_maxrss is in kB on linux
+                const std::size_t peak_rss = Utilities::MPI::max(
+                        static_cast<std::size_t>(usage.ru_maxrss)*1024, mpi_comm);
 
-        data_out.build_patches();
+                deallog << "Benchmark order " << order << " refinements " << n_refinements << " " <<
+                        ordering_name << " ordering: " << problem.dof_handler.n_dofs() <<
+                        " dofs, update " << times["update"] << " s, " << dofs_per_second <<
+                        " dofs/s per rhs evaluation, " << cache_misses << " cache misses" <<
+                        (float_operators ? ", single precision operators" : "") << std::endl;
+                if(!is_root) continue;
+                csv_file << order << "," << n_refinements << "," << ordering_name << "," <<
+                        problem.triang.n_global_active_cells() << "," <<
+                        problem.dof_handler.n_dofs() << "," << n_processes << "," <<
+                        MultithreadInfo::n_threads() << "," << n_steps;
+                for(const std::string &phase: phases) csv_file << "," << times[phase];
+                csv_file << "," << dofs_per_second << "," << memory << "," << peak_rss << "," <<
+                        cache_misses << "," << float_operators << "," << operator_error << "\n";
 
-        std::ofstream ofile(filename);
-        data_out.write_vtk(ofile);
+                json_file << (first_case ? "\n" : ",\n") << "  {\"order\": " << order <<
+                        ", \"refinements\": " << n_refinements <<
+                        ", \"ordering\": \"" << ordering_name << "\"" <<
+                        ", \"n_cells\": " << problem.triang.n_global_active_cells() <<
+                        ", \"n_dofs\": " << problem.dof_handler.n_dofs() <<
+                        ", \"n_processes\": " << n_processes <<
+                        ", \"n_threads\": " << MultithreadInfo::n_threads() <<
+                        ", \"n_steps\": " << n_steps;
+                for(const std::string &phase: phases){
+                        json_file << ", \"" << phase << "\": " << times[phase];
+                }
+                json_file << ", \"dofs_per_second\": " << dofs_per_second <<
+                        ", \"memory\": " << memory << ", \"peak_rss\": " << peak_rss <<
+                        ", \"cache_misses\": " << cache_misses <<
+                        ", \"float_operators\": " << (float_operators ? "true" : "false") <<
+                        ", \"operator_error\": " << operator_error << "}";
+                first_case = false;
+        } // loop over cases
+        if(is_root) json_file << "\n]\n";
+        #ifdef __linux__
+        if(miss_counter >= 0) close(miss_counter);
+        #endif
 }
 
 
@@ -377,17 +4433,8 @@ void advection2D::test()
         problem.assemble_system();
         problem.print_matrices();
         problem.set_IC();
-        problem.set_boundary_ids();
-
-        double start_time = 0.0, end_time = 0.5, time_step = 0.005;
-        uint time_counter = 0;
-        std::string base_filename = "output.vtk";
-        problem.output(base_filename + ".0"); // initial condition
-        for(double cur_time = start_time; cur_time<end_time; cur_time+=time_step){
-                deallog << "Step " << time_counter << " time " << cur_time << std::endl;
-                problem.update(time_step);
-                time_counter++;
-                problem.output(base_filename + "." + std::to_string(time_counter));
-        }
+
+        deallog << "Stable time step: " << problem.stable_time_step(0.5) << std::endl;
+        problem.time_loop(0.5, 0.5, "output");
 }
 #endif
@@ -6,10 +6,26 @@
 // Includes: most of them are from step-12 and dflo
 #include <deal.II/base/quadrature_lib.h>
 #include <deal.II/base/function.h>
+#include <deal.II/base/function_parser.h>
+#include <deal.II/base/parallel.h>
+#include <deal.II/base/multithread_info.h>
+#include <deal.II/base/work_stream.h>
+#include <deal.II/base/timer.h>
+#include <deal.II/base/parameter_handler.h>
+#include <deal.II/base/index_set.h>
+#include <deal.II/base/mpi.h>
+#include <deal.II/base/utilities.h>
+#include <deal.II/base/aligned_vector.h>
+#include <deal.II/base/thread_local_storage.h>
+#include <deal.II/base/vectorization.h>
 #include <deal.II/lac/vector.h>
+#include <deal.II/lac/la_parallel_vector.h>
 #include <deal.II/lac/dynamic_sparsity_pattern.h>
 #include <deal.II/lac/sparse_matrix.h>
 #include <deal.II/grid/tria.h>
+#include <deal.II/distributed/tria.h>
+#include <deal.II/distributed/grid_refinement.h>
+#include <deal.II/distributed/solution_transfer.h>
 #include <deal.II/grid/grid_generator.h>
 #include <deal.II/grid/grid_out.h>
 #include <deal.II/grid/grid_refinement.h>
@@ -19,6 +35,7 @@
 #include <deal.II/dofs/dof_handler.h>
 #include <deal.II/dofs/dof_accessor.h>
 #include <deal.II/dofs/dof_tools.h>
+#include <deal.II/dofs/dof_renumbering.h>
 #include <deal.II/numerics/data_out.h>
 #include <deal.II/fe/mapping_q1.h>
 
@@ -29,10 +46,43 @@
 #include <deal.II/lac/precondition_block.h>
 
 #include <deal.II/numerics/vector_tools.h>
+#include <deal.II/numerics/solution_transfer.h>
 #include <deal.II/numerics/data_out.h>
 
+// used for checkpoints of a serial triangulation
+#ifndef DEAL_II_WITH_P4EST
+#include <boost/archive/binary_oarchive.hpp>
+#include <boost/archive/binary_iarchive.hpp>
+#endif
+
 #include <fstream>
 #include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
+
+// used to map the operator cache and to get the peak memory
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+// used to count the cache misses in benchmark()
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+#include <limits>
+#include <numeric>
+#include <algorithm>
 
 // #include <deal.II/numerics/derivative_approximation.h> // for adaptive mesh
 
@@ -41,10 +91,26 @@
 #include "IC.h"
 #include "BCs.h"
 #include "num_fluxes.h"
+#include "sum_factorization.h"
+#include "output_writer.h"
+#include "device_operator.h"
+#include "instrumentation.h"
 
 #ifndef advection2D_h
 #define advection2D_h
 
+/**
+ * @brief Triangulation type used by advection2D
+ * 
+ * A distributed triangulation is used when deal.II is configured with p4est. Otherwise, a serial
+ * triangulation is used and the code runs on a single process.
+ */
+#ifdef DEAL_II_WITH_P4EST
+using triangulation_type = parallel::distributed::Triangulation<2>;
+#else
+using triangulation_type = Triangulation<2>;
+#endif
+
 /**
  * @class advection2D
  * @brief A class for 2D linear advection equation
@@ -69,7 +135,9 @@
  * @f[
  * \{\phi\}^{n+1} = \{\phi\}^n + \left( [S]\{\phi\}^n - \sum_{\text{faces}}[L]\{f^*\}^n \right)
  * @f]
- * Here @f$[S]@f$ is the stiffness matrix and @f$[L]@f$ is the lifting matrix
+ * Here @f$[S]@f$ is the stiffness matrix and @f$[L]@f$ is the lifting matrix. Apart from this
+ * forward Euler step, the Runge-Kutta schemes in advection2D::time_integrator can be used. See
+ * update()
  * @note Every face will have its own lifting matrix. The contribution of cell vertices from two
  * different faces cannot be clubbed into a single lifting matrix because two numerical fluxes act
  * at every cell vertex. Accordingly, 4 different numerical flux vectors will multiply these 4
@@ -77,32 +145,282 @@
  * 
  * @remark The code is working fine, but the problem considered requires a limiter.
  * 
- * @todo Add function for calculating stable time step
+ * The class runs with MPI on a distributed triangulation (see ::triangulation_type). Every process
+ * stores the data of its locally owned cells only, and the neighbor side values of faces shared with
+ * ghost cells are exchanged in rhs().
+ * 
  * @todo Add limiter functionality
  */
 
+/**
+ * @brief Dof counts and face dof tables of <code>FE_DGQ<2></code> of a degree known at compile time
+ * 
+ * These are the compile time counterparts of advection2D::face_first_dof and
+ * advection2D::face_dof_increment, used by the kernels of advection2D specialised on the degree
+ */
+template <int degree>
+struct dof_tables
+{
+        static_assert(degree > 0, "dof tables are defined for positive degrees only");
+        static constexpr uint n_1d = degree+1; // number of 1D dofs
+        static constexpr uint dofs_per_cell = n_1d*n_1d;
+        static constexpr uint dofs_per_face = n_1d;
+        static constexpr std::array<uint, 4> face_first_dof{0, degree, 0, n_1d*degree};
+        static constexpr std::array<uint, 4> face_dof_increment{n_1d, n_1d, 1, 1};
+};
+
 class advection2D
 {
 
         public:
-        advection2D(const uint order);
+        /**
+         * @brief Storage mode of stiffness and lifting matrices
+         */
+        enum class operator_mode
+        {
+                per_cell, ///< every cell has its own matrices
+                shared, ///< similar affine cells share matrices, see assemble_system()
+                sum_factorized ///< no matrices, sum factorization is used, see sum_factorization
+        };
+
+        /**
+         * @brief Time integration scheme used by update()
+         */
+        enum class time_integrator
+        {
+                forward_euler, ///< first order, one rhs evaluation
+                ssprk3, ///< 3 stage 3rd order strong stability preserving Runge-Kutta
+                lsrk45, ///< 5 stage 4th order low storage Runge-Kutta of Carpenter and Kennedy
+                lts_forward_euler ///< forward Euler with local time steps, see update_lts()
+        };
+
+        /**
+         * @brief Order of the locally owned cells, and so of the dofs, faces and operators, see
+         * order_cells()
+         */
+        enum class cell_ordering
+        {
+                hierarchy, ///< order of <code>active_cell_iterators()</code>
+                morton, ///< along the Morton (Z order) curve of the cell centres
+                hilbert ///< along the Hilbert curve of the cell centres
+        };
+
+        advection2D(const uint order, const operator_mode op_mode = operator_mode::shared,
+                const time_integrator integrator = time_integrator::forward_euler);
+        ~advection2D();
         // first cell dof on a face
         const std::array<uint, GeometryInfo<2>::faces_per_cell> face_first_dof;
         // increment of cell dof on a face
         const std::array<uint, GeometryInfo<2>::faces_per_cell> face_dof_increment;
-        std::array< std::function<double(const double)>, 3 > bc_fns = {b0,b1,b2};
+        /// Boundary conditions, one per boundary id, see set_boundary_ids()
+        bc_set bcs = default_bcs();
+        static void set_n_threads(const uint n_threads);
+        void set_operator_cache(const std::string &directory);
+        void set_wind(const wind_field &new_wind);
+        void set_adaptivity(const uint interval, const double refine_fraction,
+                const double coarsen_fraction, const uint min_level, const uint max_level);
+        void set_device(const bool enable);
+        void set_trace(const bool enable);
+        void set_cell_ordering(const cell_ordering new_ordering);
+        void set_float_operators(const bool enable, const double tolerance = 1e-5);
+        void set_diagnostics(const uint interval,
+                const std::function<double(const Point<2>&, const double)> &exact = nullptr);
+        static void declare_parameters(ParameterHandler &prm);
+        static void run(ParameterHandler &prm);
+        static void benchmark(const std::vector<uint> &orders, const std::vector<uint> &refinements,
+                const uint n_steps, const operator_mode op_mode, const time_integrator integrator,
+                const std::vector<cell_ordering> &orderings, const bool float_operators,
+                const std::string &base_name);
+
+        /**
+         * @brief Type of the solution vector and of the time derivative computed by rhs()
+         */
+        using state = LinearAlgebra::distributed::Vector<double>;
 
         private:
-        void setup_system();
+        void setup_system(const uint n_refinements = 5);
+        void setup_dofs();
         void assemble_system();
+        void assemble_new_operators();
+        void reassemble_system(const std::vector<uint> &old_cells);
+        void compute_smoothness_indicator(Vector<float> &indicator) const;
+        void adapt_mesh();
+        void assemble_face_geometry();
         void set_IC();
+        void set_ensemble(const std::vector<std::function<double(const Point<2>&)>> &ICs,
+                const std::vector<bc_set> &member_bcs);
         void set_boundary_ids();
+        void order_cells();
+        void build_face_data();
+        void compute_subface_matrices();
+        /**
+         * @brief Per thread scratch data for assemble_system()
+         */
+        struct assembly_scratch
+        {
+                assembly_scratch(const FiniteElement<2> &fe);
+                assembly_scratch(const assembly_scratch &other);
+                FEValues<2> fe_values;
+                FEFaceValues<2> fe_face_values;
+                FullMatrix<double> l_mass, l_mass_inv, l_diff;
+                // tabulated values, see assemble_cell_operators()
+                std::vector<double> values, JxW_values, wind_grads, l_flux;
+                std::vector<uint> face_dofs;
+                // operators of the cell, see assemble_cell_operators()
+                FullMatrix<double> stiff_mat;
+                std::array<FullMatrix<double>, GeometryInfo<2>::faces_per_cell> lift_mat;
+        };
+
+        /**
+         * @brief Operator key of a cell, the WorkStream copy data of assemble_system()
+         */
+        struct assembly_key
+        {
+                uint c; // cell index
+                bool affine; // whether key is valid
+                std::vector<long long> key;
+                double size;
+        };
+
+        void assemble_sum_factorized();
+        void assemble_sum_factorized(const uint begin, const uint end);
+        void assemble_cell_operators(const DoFHandler<2>::active_cell_iterator &cell,
+                assembly_scratch &scratch,
+                FullMatrix<double> &stiff_mat,
+                std::array<FullMatrix<double>, GeometryInfo<2>::faces_per_cell> &lift_mat) const;
+        void fill_face_geometry(const uint begin, const uint end);
+        void fill_face_winds(const uint begin, const uint end);
+        Tensor<1,2> assembled_wind(const Point<2> &p) const;
+        double wind_factor(const double time) const;
+        void update_wind(const double time);
+        uint op_block_size() const;
+        std::uint64_t operator_cache_hash() const;
+        std::string operator_cache_filename() const;
+        bool load_operator_cache();
+        void save_operator_cache() const;
+        void unmap_operators();
+        void convert_operators();
+        double check_float_operators();
+        bool operator_key(const DoFHandler<2>::active_cell_iterator &cell,
+                const std::vector<Point<2>> &q_points, std::vector<long long> &key,
+                double &size) const;
+        void update_time_steps();
+        void compute_cell_time_steps(const uint begin, const uint end);
+        void update_stable_time_step();
+        void setup_local_time_stepping();
+        void permute_faces(const std::vector<uint> &order);
+        double stable_time_step(const double courant) const;
+        void time_loop(const double end_time, const double courant, const std::string &base_name,
+                const uint output_interval = 1, const double output_time_interval = 0.0,
+                const uint checkpoint_interval = 0);
         void update(const double time_step);
+        /// Signature of apply_operator() and apply_ensemble_operator()
+        using operator_fn = void (advection2D::*)(const state&, state&, const double, const double,
+                const double, const double, const state*);
+        void integrate(const double time_step, state &u, state &v, const operator_fn apply);
+        void update_lts(const double time_step);
+        void upload_to_device();
+        void download_from_device();
+        void integrate_device(const double time_step);
+        void apply_device_operator(const uint in, const uint out, const double time, const double a,
+                const double b, const double c, const uint w);
+        void accumulate_face_fluxes(const uint begin, const uint end, const double sub_step,
+                const double factor);
+        void compute_lts_cells(const uint level, const uint begin, const uint end,
+                const double sub_step, const double factor);
+        void get_lts_face_flux(const uint f, const uint level, const double sub_step, double *flux);
+        uint n_rhs_evaluations() const;
+        void rhs(const state &phi, state &out, const double time);
+        void apply_operator(const state &phi, state &out, const double time, const double a,
+                const double b, const double c = 0.0, const state *w = nullptr);
+        void cell_costs(double &bytes, double &flops) const;
+
+        /**
+         * @brief In-situ reductions of the solution, see set_diagnostics()
+         */
+        struct diagnostics
+        {
+                double mass = 0.0; // integral of the solution
+                double min = std::numeric_limits<double>::max(); // min dof value
+                double max = std::numeric_limits<double>::lowest(); // max dof value
+                double error_sq = 0.0; // squared L2 error, used only with an exact solution
+                void merge(const diagnostics &other);
+        };
+        void fill_diagnostic_geometry();
+        template <int degree>
+        void add_cell_diagnostics(const uint cell, const double *phi, double *work,
+                diagnostics &sums) const;
+        void merge_diagnostics(const diagnostics &sums);
+        void compute_diagnostics(const state &phi);
+        void add_and_diagnose(state &u, const double factor, const state &v);
+        void report_diagnostics(std::ostream &csv) const;
+
+        // ensemble mode, see set_ensemble()
+        void ensemble_time_loop(const double end_time, const double courant,
+                const std::string &base_name, const uint output_interval = 0);
+        void output_ensemble(const std::string &base_name, const uint counter, const double time);
+        void apply_ensemble_operator(const state &phi, state &out, const double time,
+                const double a, const double b, const double c, const state *w);
+        void compute_ensemble_fluxes(const state &phi, const uint begin, const uint end);
+        void compute_ensemble_coarse_fluxes(const uint begin, const uint end);
+        void compute_ensemble_cells(const state &phi, state &out, const double a, const double b,
+                const double c, const state *w, const uint begin, const uint end);
+        template <typename Number>
+        void add_ensemble_products(const uint cell, const Number *op_set, const double *phi,
+                double *rhs) const;
+
+        // kernels of apply_operator(), specialised on the degree for degree > 0 and with runtime
+        // sizes for degree = -1
+        template <int degree>
+        void compute_boundary_fluxes(const state &phi, const double time, const uint begin,
+                const uint end);
+        template <int degree, typename bc_value>
+        void compute_boundary_batch(const state &phi, const uint begin, const uint end,
+                const bc_value &bc);
+        template <int degree>
+        void compute_internal_fluxes(const state &phi, const uint begin, const uint end);
+        void compute_hanging_fluxes(const state &phi, const uint begin, const uint end);
+        void compute_coarse_fluxes(const uint begin, const uint end);
+        template <int degree>
+        void compute_cells(const state &phi, state &out, const double a, const double b,
+                const double c, const state *w, const uint begin, const uint end);
+        template <int degree>
+        void compute_cell_batch(const double *phi, double *out, const double a, const double b,
+                const double c, const double *w, const uint first_cell);
+        bool is_batchable(const uint first_cell) const;
+        template <int degree>
+        void get_face_dofs(const uint face_id, uint &first_dof, uint &dof_increment) const;
+        template <int degree>
+        void add_lifting(const uint c, const uint face_id, const double *flux, const double factor,
+                double *rhs) const;
+        template <int degree>
+        void add_stiffness(const uint c, const double *phi, double *rhs, double *work) const;
+        /// Member pointers to the kernel instances of a degree, see select_kernels()
+        struct kernel_set
+        {
+                void (advection2D::*boundary_fluxes)(const state&, const double, const uint,
+                        const uint);
+                void (advection2D::*internal_fluxes)(const state&, const uint, const uint);
+                void (advection2D::*cells)(const state&, state&, const double, const double,
+                        const double, const state*, const uint, const uint);
+        };
+        static kernel_set select_kernels(const uint degree);
+        template <int degree>
+        static kernel_set kernels_of_degree();
+
         void print_matrices() const;
-        void output(const std::string &filename) const;
+        std::size_t memory_consumption() const;
+        void output(const std::string &base_name, const uint counter, const double time);
+        void save_checkpoint(const std::string &base_name, const bool save_operators) const;
+        void load_checkpoint(const std::string &base_name);
 
         // class variables
-        Triangulation<2> triang;
+        const operator_mode op_mode;
+        const time_integrator integrator;
+        cell_ordering ordering = cell_ordering::hilbert;
+        const kernel_set kernels; // kernels of apply_operator() for the degree of fe
+        const MPI_Comm mpi_comm;
+        triangulation_type triang;
         const MappingQ1<2> mapping;
 
         // By default, fe assumes all dofs to be inside cell. Thus, fe.dofs_per_face will return 0.
@@ -110,17 +428,169 @@ class advection2D
         FE_DGQ<2> fe;
         FE_FaceQ<2> fe_face; // face finite element
         DoFHandler<2> dof_handler;
-        std::vector<Point<2>> dof_locations; // all dof locations
+        output_writer writer; // background writer used by output()
+        wind_field wind_fn; // advecting wind, see set_wind()
+        // time of the wind in the face geometry cache and the sum factorization data, used only for
+        // a general wind, see update_wind()
+        double wind_time = 0.0;
 
         // solution has to be global to enable results output, a local solution cannot used to
         // output results
-        Vector<double> g_solution; // global solution
-        Vector<double> gold_solution; // global old solution
-        std::vector<Vector<double>> l_rhs; // local rhs of every cell
+        // Both store locally owned dofs and have ghost entries for the neighbor side face dofs of
+        // faces shared with ghost cells. These are the two registers of the time integrators, see
+        // update()
+        state g_solution; // global solution
+        state gold_solution; // global old solution
+        // Dofs are numbered cell wise, so that owned dofs of cell i start at i*fe.dofs_per_cell in
+        // local storage of solution vectors
+        // ensemble of solutions with the members of a dof contiguous, see set_ensemble()
+        uint n_members = 0; // number of members, 0 if not in ensemble mode
+        state ensemble_solution, ensemble_old_solution;
+        std::vector<bc_set> ensemble_bcs; // boundary conditions of every member
+        // prescribed boundary values of the current stage, member m of boundary id b at
+        // b*n_members + m, see apply_ensemble_operator()
+        std::vector<double> ensemble_bc_values;
+        // numerical fluxes of every member, member m of face dof i at i*n_members + m
+        std::vector<double> ensemble_face_fluxes;
+        // per thread cell rhs and scratch of add_stiffness(), see compute_cells()
+        Threads::ThreadLocalStorage<AlignedVector<double>> cell_work;
+        // per thread interleaved data of a cell batch, see compute_cell_batch()
+        Threads::ThreadLocalStorage<AlignedVector<VectorizedArray<double>>> cell_batch_work;
+        // per thread coarse side values of all members at a hanging face, see
+        // compute_ensemble_fluxes()
+        Threads::ThreadLocalStorage<AlignedVector<double>> ensemble_face_work;
+
+        // stiffness and lifting matrices, one set for every operator id
+        // A set is a block of op_block_size() values: the stiffness matrix followed by the 4
+        // lifting matrices, all row major
+        uint n_ops = 0; // number of operator sets
+        const double *op_data = nullptr; // all sets, points to op_storage or a mapped cache file
+        AlignedVector<double> op_storage; // not used if the operators are mapped
+        // the sets rounded to single precision, used by the cell kernels instead of op_data if not
+        // null, see set_float_operators()
+        const float *op_data_float = nullptr;
+        AlignedVector<float> op_storage_float;
+        bool float_ops = false; // whether single precision operators are requested
+        double float_op_tolerance = 1e-5; // max relative rhs error, see check_float_operators()
+        void *op_map = nullptr; // mapped operator cache file, see load_operator_cache()
+        std::size_t op_map_size = 0;
+        std::string op_cache_dir; // operator cache directory, empty if caching is disabled
+        std::vector<uint> cell_op_ids; // operator id of every cell
+        std::vector<double> cell_op_scales; // scaling of operators of every cell
+        // operator key (see operator_key()) to operator id and size of the cell it was computed for
+        std::map<std::vector<long long>, std::pair<uint, double>> op_keys;
+
+        // data for operator_mode::sum_factorized
+        const sum_factorization sf; // 1D matrices and kernels
+        std::vector<double> sf_coeffs; // c_x and c_y of every cell, see sum_factorization
+        std::vector<double> sf_inv_sizes; // 1/h_x and 1/h_y of every cell
+
+        /**
+         * @brief Connectivity of a face, stored in advection2D::faces
+         *
+         * Cell indices here are the positions in advection2D::cells, i.e., numbering of locally
+         * owned cells. For an internal face, the owner is the cell with higher index. For a face
+         * shared with a ghost cell, the owner is the cell with higher <code>CellId</code>, so that
+         * both the processes sharing the face agree on it, and the index of the ghost side is
+         * invalid. For a boundary face, the owner is the only cell containing it and
+         * advection2D::face_info::neighbor is invalid.
+         * 
+         * A hanging face is a subface of the face of a coarser cell. Its owner is always the
+         * finer cell, whose face it is, and its neighbor the coarser cell. Its flux is computed at
+         * the face dofs of the finer cell. The coarser cell instead sees a coarse side face, whose
+         * owner is the coarser cell and whose neighbor is invalid, with the fluxes of the two
+         * hanging faces projected onto it. See compute_coarse_fluxes()
+         */
+        struct face_info
+        {
+                uint owner; // owner cell index
+                uint neighbor; // neighbor cell index
+                uint owner_face_id; // face id wrt owner
+                uint neighbor_face_id; // face id wrt neighbor
+                bool at_boundary;
+                types::boundary_id boundary_id;
+                uint subface; // subface number on the coarse side of a hanging face, else invalid
+        };
+
+        // face connectivity, built in setup_dofs(), ordered as described in build_face_data()
+        std::vector<face_info> faces;
+        uint n_boundary_faces; // end of boundary faces
+        uint n_internal_faces; // end of internal faces between owned cells of the same level
+        uint n_local_faces; // end of hanging faces between owned cells
+        uint n_shared_faces; // end of faces shared with ghost cells of the same level
+        uint n_flux_faces; // end of hanging faces with a ghost side, coarse side faces follow
+        // the two hanging faces (indices in advection2D::faces) of every coarse side face
+        std::vector<std::array<uint, 2>> coarse_subfaces;
+        // row major 1D matrices of hanging faces, one per subface, see compute_subface_matrices()
+        // interpolation from coarse face dofs to subface dofs
+        std::array<std::vector<double>, 2> subface_interpolation;
+        // projection of subface fluxes onto coarse face dofs
+        std::array<std::vector<double>, 2> subface_projection;
+        std::vector<DoFHandler<2>::active_cell_iterator> face_owner_cells; // owner side cells
+        // local dof ids (index in local storage of solution vectors, including ghosts) of face dofs
+        // on owner and neighbor side, face i starts at i*fe_face.dofs_per_face
+        std::vector<uint> face_dof_ids, face_dof_ids_neighbor;
+        // index in advection2D::faces of every cell face, face j of cell i is at i*faces_per_cell+j
+        std::vector<uint> cell_faces;
+
+        // face geometry cache, filled in assemble_system(), face i starts at
+        // i*fe_face.dofs_per_face. Normals point away from owner
+        std::vector<Tensor<1,2>> face_normals;
+        std::vector<Point<2>> face_points; // location of face dofs
+        std::vector<double> face_wind_normal; // wind dotted with normal at face dofs
+        std::vector<double> face_abs_wind_normal; // abs of face_wind_normal
+        // stable time step of every cell at unit Courant number, see compute_cell_time_steps()
+        std::vector<double> cell_time_steps;
+        double min_time_step; // min of cell_time_steps over all processes
+
+        // data of time_integrator::lts_forward_euler, see setup_local_time_stepping()
+        static constexpr uint max_time_step_level = 6; // steps of at most 2^6 fine steps
+        uint n_time_step_levels = 1; // max level over all processes plus 1
+        std::vector<uint> cell_levels; // time step level of every cell
+        std::vector<std::vector<uint>> lts_level_cells; // cell indices of every level
+        std::vector<uint> face_levels; // level of every face with a flux, min of its two sides
+        std::vector<bool> face_level_interfaces; // whether the two sides of a face differ in level
+        // for every level, end of the faces up to that level in each of the 5 ranges of flux faces
+        std::vector<std::array<uint, 5>> lts_face_ends;
+        // flux integrals of level interface faces since the step start of their slower side
+        std::vector<double> face_flux_sums;
+
+        // mesh adaptation settings, see set_adaptivity()
+        uint adapt_interval = 0;
+        double adapt_refine_fraction = 0.3, adapt_coarsen_fraction = 0.05;
+        uint adapt_min_level = 0, adapt_max_level = 0;
+
+        // device backend, see set_device()
+        bool use_device = false;
+        // whether the solution is on the device, so that advection2D::g_solution is stale
+        bool device_resident = false;
+        std::unique_ptr<device_operator> device;
+        bool trace = false; // whether time_loop() writes the instrumentation trace, see set_trace()
+
+        // in-situ diagnostics, see set_diagnostics()
+        uint diag_interval = 0; // report every these many steps, 0 to disable
+        std::function<double(const Point<2>&, const double)> exact_solution; // empty if unknown
+        // JxW values and locations (only with an exact solution) of the cell quad points, cell i
+        // starts at i*fe.dofs_per_cell, see fill_diagnostic_geometry()
+        std::vector<double> diag_JxW;
+        std::vector<Point<2>> diag_points;
+        bool diagnose_step = false; // whether the current step of update() is diagnosed
+        bool diagnose = false; // whether the kernels writing the final stage fill diag_sums
+        double diag_time = 0.0; // time of the diagnosed solution
+        diagnostics diag_sums; // reductions over the owned cells
+        std::mutex diag_mutex; // guards diag_sums
+        // mass at the start of the run, saved in checkpoints, NaN if not known
+        double diag_initial_mass = std::numeric_limits<double>::quiet_NaN();
 
-        // stiffness and lifting matrices
-        std::vector<FullMatrix<double>> stiff_mats;
-        std::vector< std::array<FullMatrix<double>, GeometryInfo<2>::faces_per_cell> > lift_mats;
+        // time and number of steps done of advection2D::g_solution, saved in checkpoints
+        double cur_time = 0.0;
+        uint time_counter = 0;
+        static constexpr uint checkpoint_version = 3; // format version of checkpoint files
+        // maximum number of face dofs per call to the vectorized rusanov_flux()
+        static constexpr uint flux_batch_size = 256;
+        // numerical normal flux at face dofs wrt owner, computed in every update
+        std::vector<double> face_fluxes;
+        std::vector<DoFHandler<2>::active_cell_iterator> cells; // owned cell iterators by index
 
 
 
@@ -0,0 +1,130 @@
+/**
+ * @file benchmark.cc
+ * @brief The main file of the benchmark executable
+ *
+ * Usage: <code>benchmark [--orders=1,2,3] [--refinements=4,5,6] [--steps=20]
+ * [--mode=per_cell|shared|sum_factorized]
+ * [--integrator=forward_euler|ssprk3|lsrk45|lts_forward_euler] [--threads=n]
+ * [--orderings=hierarchy,morton,hilbert] [--float-operators] [--output=benchmark]</code>
+ *
+ * The default orderings are hierarchy and hilbert, so that the cache misses of the update are
+ * compared with and without the space filling curve order. With --float-operators, the matrices
+ * are stored in single precision. See advection2D::benchmark()
+ */
+
+#include "advection2D.h"
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Parses an unsigned integer, throws if @p value is not one
+ */
+uint parse_uint(const std::string &value)
+{
+        std::size_t end;
+        const unsigned long result = std::stoul(value, &end);
+        if(end != value.size() || value[0] == '-') throw std::invalid_argument(value);
+        return result;
+}
+
+/**
+ * @brief Parses a non-empty comma separated list of unsigned integers, throws if a value is not
+ * one
+ */
+std::vector<uint> parse_list(const std::string &list)
+{
+        std::vector<uint> values;
+        std::stringstream ss(list);
+        std::string value;
+        while(std::getline(ss, value, ',')) values.emplace_back(parse_uint(value));
+        if(values.empty()) throw std::invalid_argument(list);
+        return values;
+}
+
+/**
+ * @brief Parses a comma separated list of cell orderings, throws if a name is not known
+ */
+std::vector<advection2D::cell_ordering> parse_orderings(const std::string &list)
+{
+        std::vector<advection2D::cell_ordering> orderings;
+        std::stringstream ss(list);
+        std::string name;
+        using ordering = advection2D::cell_ordering;
+        while(std::getline(ss, name, ',')){
+                if(name == "hierarchy") orderings.emplace_back(ordering::hierarchy);
+                else if(name == "morton") orderings.emplace_back(ordering::morton);
+                else if(name == "hilbert") orderings.emplace_back(ordering::hilbert);
+                else throw std::invalid_argument("Unknown cell ordering " + name);
+        }
+        if(orderings.empty()) throw std::invalid_argument(list);
+        return orderings;
+}
+
+int main(int argc, char *argv[])
+{
+        Utilities::MPI::MPI_InitFinalize mpi_init(argc, argv, numbers::invalid_unsigned_int);
+        if(Utilities::MPI::this_mpi_process(MPI_COMM_WORLD) == 0) deallog.depth_console(1);
+        else deallog.depth_console(0);
+
+        std::vector<uint> orders = {1, 2, 3}, refinements = {4, 5, 6};
+        uint n_steps = 20;
+        advection2D::operator_mode op_mode = advection2D::operator_mode::shared;
+        advection2D::time_integrator integrator = advection2D::time_integrator::ssprk3;
+        std::vector<advection2D::cell_ordering> orderings = {
+                advection2D::cell_ordering::hierarchy, advection2D::cell_ordering::hilbert};
+        bool float_operators = false;
+        std::string base_name = "benchmark";
+        for(int i=1; i<argc; i++){
+                const std::string arg = argv[i];
+                const std::size_t pos = arg.find('=');
+                const std::string key = arg.substr(0, pos);
+                const std::string value = (pos == std::string::npos) ? "" : arg.substr(pos+1);
+                // a malformed value is reported like an unknown argument
+                try{
+                        if(key == "--orders") orders = parse_list(value);
+                        else if(key == "--refinements") refinements = parse_list(value);
+                        else if(key == "--steps") n_steps = parse_uint(value);
+                        else if(key == "--output") base_name = value;
+                        else if(key == "--threads") advection2D::set_n_threads(parse_uint(value));
+                        else if(key == "--orderings") orderings = parse_orderings(value);
+                        else if(key == "--float-operators") float_operators = true;
+                        else if(key == "--mode" && value == "per_cell"){
+                                op_mode = advection2D::operator_mode::per_cell;
+                        }
+                        else if(key == "--mode" && value == "shared"){
+                                op_mode = advection2D::operator_mode::shared;
+                        }
+                        else if(key == "--mode" && value == "sum_factorized"){
+                                op_mode = advection2D::operator_mode::sum_factorized;
+                        }
+                        else if(key == "--integrator" && value == "forward_euler"){
+                                integrator = advection2D::time_integrator::forward_euler;
+                        }
+                        else if(key == "--integrator" && value == "ssprk3"){
+                                integrator = advection2D::time_integrator::ssprk3;
+                        }
+                        else if(key == "--integrator" && value == "lsrk45"){
+                                integrator = advection2D::time_integrator::lsrk45;
+                        }
+                        else if(key == "--integrator" && value == "lts_forward_euler"){
+                                integrator = advection2D::time_integrator::lts_forward_euler;
+                        }
+                        else{
+                                std::cerr << "Unknown argument " << arg << std::endl;
+                                return 1;
+                        }
+                }
+                catch(const std::logic_error &){
+                        std::cerr << "Invalid value in argument " << arg << std::endl;
+                        return 1;
+                }
+        }
+
+        advection2D::benchmark(orders, refinements, n_steps, op_mode, integrator, orderings,
+                float_operators, base_name);
+        return 0;
+}
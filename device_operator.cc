@@ -0,0 +1,35 @@
+/**
+ * @file device_operator.cc
+ * @brief Stub of device_operator used without the cmake option ADVECTION_WITH_CUDA
+ * 
+ * The CUDA implementation is in device_operator.cu
+ */
+
+#include <stdexcept>
+
+#include "device_operator.h"
+
+#ifndef ADVECTION_WITH_CUDA
+
+/// Throws, device_operator is not available in this build
+static void not_available()
+{
+        throw std::runtime_error("Built without CUDA, configure with -DADVECTION_WITH_CUDA=ON");
+}
+
+device_operator::device_operator() {}
+device_operator::~device_operator() {}
+bool device_operator::available() { return false; }
+void device_operator::upload(const device_operator_data &) { not_available(); }
+void device_operator::set_solution(const unsigned int, const double *) { not_available(); }
+void device_operator::get_solution(const unsigned int, double *) const { not_available(); }
+void device_operator::apply(const unsigned int, const unsigned int, const double, const double,
+        const double, const unsigned int, const std::array<double, n_boundary_ids> &,
+        const std::array<bool, n_boundary_ids> &)
+{
+        not_available();
+}
+void device_operator::add(const unsigned int, const double, const unsigned int) { not_available(); }
+void device_operator::swap(const unsigned int, const unsigned int) { not_available(); }
+
+#endif
@@ -0,0 +1,259 @@
+/**
+ * @file device_operator.cu
+ * @brief CUDA implementation of device_operator, compiled with the cmake option ADVECTION_WITH_CUDA
+ */
+
+#include <cuda_runtime.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "device_operator.h"
+
+/// Throws if @p error is not <code>cudaSuccess</code>
+static void check(const cudaError_t error)
+{
+        if(error != cudaSuccess){
+                throw std::runtime_error(std::string("CUDA error: ") + cudaGetErrorString(error));
+        }
+}
+
+/// Allocates @p n entries on the device and copies them from @p src
+template <typename T>
+static T* device_copy(const T *src, const unsigned int n)
+{
+        T *dst = nullptr;
+        check(cudaMalloc(&dst, sizeof(T)*n));
+        if(src != nullptr) check(cudaMemcpy(dst, src, sizeof(T)*n, cudaMemcpyHostToDevice));
+        return dst;
+}
+
+/**
+ * @brief Sizes, face dof tables, boundary conditions and device arrays of the operator
+ * 
+ * Passed by value to the kernels, so it does not own the arrays, see device_operator::device_data
+ */
+struct device_arrays
+{
+        unsigned int dofs_per_cell, dofs_per_face, n_cells, n_faces, n_boundary_faces;
+        unsigned int op_block_size;
+        unsigned int first_dof[4], dof_increment[4];
+        double bc_values[n_boundary_ids];
+        bool bc_extrapolations[n_boundary_ids];
+        double *op_data, *cell_op_scales, *face_wind_normal, *face_abs_wind_normal, *face_fluxes;
+        unsigned int *cell_op_ids, *cell_faces, *face_owners, *face_boundary_ids, *face_dof_ids,
+                *face_dof_ids_neighbor;
+};
+
+/**
+ * @brief Owner of the device arrays and solution registers of device_operator
+ */
+struct device_operator::device_data
+{
+        device_arrays arrays;
+        std::array<double*, n_registers> registers;
+
+        ~device_data()
+        {
+                const device_arrays &d = arrays;
+                for(void *ptr: std::vector<void*>{d.op_data, d.cell_op_scales, d.face_wind_normal,
+                        d.face_abs_wind_normal, d.face_fluxes, d.cell_op_ids, d.cell_faces,
+                        d.face_owners, d.face_boundary_ids, d.face_dof_ids,
+                        d.face_dof_ids_neighbor}){
+                        cudaFree(ptr);
+                }
+                for(double *reg: registers) cudaFree(reg);
+        }
+};
+
+/**
+ * @brief Computes the Rusanov flux wrt owner of every face dof, one per thread
+ * 
+ * The neighbor side value of a boundary face dof is given by the boundary condition of its id
+ */
+static __global__ void flux_kernel(const device_arrays d, const double *phi)
+{
+        const unsigned int id = blockIdx.x*blockDim.x + threadIdx.x;
+        if(id >= d.n_faces*d.dofs_per_face) return;
+        const double o_state = phi[d.face_dof_ids[id]];
+        double n_state;
+        if(id < d.n_boundary_faces*d.dofs_per_face){
+                const unsigned int b = d.face_boundary_ids[id/d.dofs_per_face];
+                n_state = d.bc_extrapolations[b] ? o_state : d.bc_values[b];
+        }
+        else n_state = phi[d.face_dof_ids_neighbor[id]];
+        d.face_fluxes[id] = 0.5*(o_state + n_state)*d.face_wind_normal[id] +
+                0.5*d.face_abs_wind_normal[id]*(o_state - n_state);
+}
+
+/**
+ * @brief Sets @p out @f$= a\,@f$@p phi@f$ + b\,@f$rhs@f$ + c\,@f$@p w for the cell of the block,
+ * one thread per cell dof, like advection2D::compute_cells()
+ * 
+ * The cell values and the fluxes of its faces, with sign -1 for the owner, are staged in shared
+ * memory of <code>dofs_per_cell + 4 dofs_per_face</code> doubles. All reads of @p phi are done
+ * before the synchronisation, so @p out can be @p phi.
+ */
+static __global__ void cell_kernel(const device_arrays d, const double *phi, double *out,
+        const double a, const double b, const double c, const double *w)
+{
+        extern __shared__ double shared[];
+        const unsigned int cell = blockIdx.x, i = threadIdx.x, n = d.dofs_per_cell,
+                n_face = d.dofs_per_face;
+        double *cell_phi = shared, *cell_fluxes = shared + n;
+        cell_phi[i] = phi[cell*n + i];
+        unsigned int j, f, face_id;
+        for(j=i; j<4*n_face; j+=n){
+                f = d.cell_faces[4*cell + j/n_face];
+                cell_fluxes[j] = (d.face_owners[f] == cell ? -1.0 : 1.0)*
+                        d.face_fluxes[f*n_face + j%n_face];
+        }
+        __syncthreads();
+
+        const double *stiff_mat = d.op_data + d.cell_op_ids[cell]*d.op_block_size;
+        double sum = 0.0;
+        for(j=0; j<n; j++) sum += stiff_mat[i*n + j]*cell_phi[j];
+        for(face_id=0; face_id<4; face_id++){
+                const double *lift_mat = stiff_mat + (face_id+1)*n*n;
+                for(j=0; j<n_face; j++){
+                        sum += lift_mat[i*n + d.first_dof[face_id] + j*d.dof_increment[face_id]]*
+                                cell_fluxes[face_id*n_face + j];
+                }
+        }
+        const unsigned int id = cell*n + i;
+        out[id] = a*cell_phi[i] + b*d.cell_op_scales[cell]*sum + (w == nullptr ? 0.0 : c*w[id]);
+}
+
+/// Adds @p factor times @p v to @p u, both of size @p n
+static __global__ void add_kernel(const unsigned int n, double *u, const double factor,
+        const double *v)
+{
+        const unsigned int id = blockIdx.x*blockDim.x + threadIdx.x;
+        if(id < n) u[id] += factor*v[id];
+}
+
+/// Number of threads of the blocks of flux_kernel() and add_kernel()
+static constexpr unsigned int block_size = 256;
+
+/// Number of blocks of size block_size covering @p n threads
+static unsigned int n_blocks(const unsigned int n)
+{
+        return (n + block_size - 1)/block_size;
+}
+
+device_operator::device_operator() {}
+
+device_operator::~device_operator()
+{
+        delete data;
+}
+
+/**
+ * @brief Returns whether a CUDA device is present
+ */
+bool device_operator::available()
+{
+        int n_devices = 0;
+        return cudaGetDeviceCount(&n_devices) == cudaSuccess && n_devices > 0;
+}
+
+/**
+ * @brief Copies the operator and connectivity in @p host to the device and allocates the solution
+ * registers, replacing any earlier upload
+ */
+void device_operator::upload(const device_operator_data &host)
+{
+        delete data;
+        data = new device_data{};
+        device_arrays &d = data->arrays;
+        d.dofs_per_cell = host.dofs_per_cell;
+        d.dofs_per_face = host.dofs_per_face;
+        d.n_cells = host.n_cells;
+        d.n_faces = host.n_faces;
+        d.n_boundary_faces = host.n_boundary_faces;
+        d.op_block_size = host.op_block_size;
+        for(unsigned int face_id=0; face_id<4; face_id++){
+                d.first_dof[face_id] = host.face_first_dof[face_id];
+                d.dof_increment[face_id] = host.face_dof_increment[face_id];
+        }
+
+        const unsigned int n_dofs = host.n_cells*host.dofs_per_cell,
+                n_face_dofs = host.n_faces*host.dofs_per_face;
+        d.op_data = device_copy(host.op_data, host.n_ops*host.op_block_size);
+        d.cell_op_ids = device_copy(host.cell_op_ids, host.n_cells);
+        d.cell_op_scales = device_copy(host.cell_op_scales, host.n_cells);
+        d.cell_faces = device_copy(host.cell_faces, 4*host.n_cells);
+        d.face_owners = device_copy(host.face_owners, host.n_faces);
+        d.face_boundary_ids = device_copy(host.face_boundary_ids, host.n_boundary_faces);
+        d.face_dof_ids = device_copy(host.face_dof_ids, n_face_dofs);
+        d.face_dof_ids_neighbor = device_copy(host.face_dof_ids_neighbor, n_face_dofs);
+        d.face_wind_normal = device_copy(host.face_wind_normal, n_face_dofs);
+        d.face_abs_wind_normal = device_copy(host.face_abs_wind_normal, n_face_dofs);
+        d.face_fluxes = device_copy<double>(nullptr, n_face_dofs);
+        for(double *&reg: data->registers) reg = device_copy<double>(nullptr, n_dofs);
+}
+
+/**
+ * @brief Copies the cell wise @p values to register @p reg
+ */
+void device_operator::set_solution(const unsigned int reg, const double *values)
+{
+        const device_arrays &d = data->arrays;
+        check(cudaMemcpy(data->registers[reg], values, sizeof(double)*d.n_cells*d.dofs_per_cell,
+                cudaMemcpyHostToDevice));
+}
+
+/**
+ * @brief Copies register @p reg to the cell wise @p values
+ */
+void device_operator::get_solution(const unsigned int reg, double *values) const
+{
+        const device_arrays &d = data->arrays;
+        check(cudaMemcpy(values, data->registers[reg], sizeof(double)*d.n_cells*d.dofs_per_cell,
+                cudaMemcpyDeviceToHost));
+}
+
+/**
+ * @brief Sets register @p out to @f$a\,@f$@p in@f$ + b\,R(@f$@p in@f$) + c\,@f$@p w, like
+ * advection2D::apply_operator()
+ * 
+ * @p w can be device_operator::no_register. @p bc_values are the prescribed boundary values of
+ * every boundary id, not used where @p bc_extrapolations is true.
+ */
+void device_operator::apply(const unsigned int in, const unsigned int out, const double a,
+        const double b, const double c, const unsigned int w,
+        const std::array<double, n_boundary_ids> &bc_values,
+        const std::array<bool, n_boundary_ids> &bc_extrapolations)
+{
+        device_arrays &d = data->arrays;
+        for(unsigned int id=0; id<n_boundary_ids; id++){
+                d.bc_values[id] = bc_values[id];
+                d.bc_extrapolations[id] = bc_extrapolations[id];
+        }
+        flux_kernel<<<n_blocks(d.n_faces*d.dofs_per_face), block_size>>>(d, data->registers[in]);
+        check(cudaGetLastError());
+        const unsigned int shared_size = sizeof(double)*(d.dofs_per_cell + 4*d.dofs_per_face);
+        cell_kernel<<<d.n_cells, d.dofs_per_cell, shared_size>>>(d, data->registers[in],
+                data->registers[out], a, b, c, w == no_register ? nullptr : data->registers[w]);
+        check(cudaGetLastError());
+}
+
+/**
+ * @brief Adds @p factor times register @p v to register @p u
+ */
+void device_operator::add(const unsigned int u, const double factor, const unsigned int v)
+{
+        const unsigned int n = data->arrays.n_cells*data->arrays.dofs_per_cell;
+        add_kernel<<<n_blocks(n), block_size>>>(n, data->registers[u], factor, data->registers[v]);
+        check(cudaGetLastError());
+}
+
+/**
+ * @brief Swaps registers @p reg0 and @p reg1 without copying
+ */
+void device_operator::swap(const unsigned int reg0, const unsigned int reg1)
+{
+        std::swap(data->registers[reg0], data->registers[reg1]);
+}
@@ -0,0 +1,82 @@
+/**
+ * @file device_operator.h
+ * @brief Defines device_operator class
+ */
+
+#include <array>
+
+#include "BCs.h"
+
+#ifndef device_operator_h
+#define device_operator_h
+
+/**
+ * @brief Host arrays of the operator of advection2D::apply_operator(), see
+ * device_operator::upload()
+ * 
+ * All arrays are in the local (cell wise) order of advection2D. The faces are the boundary faces
+ * followed by the internal faces, and every face dof has an entry in the face arrays.
+ */
+struct device_operator_data
+{
+        unsigned int dofs_per_cell, dofs_per_face;
+        unsigned int n_cells, n_faces, n_boundary_faces;
+        unsigned int n_ops, op_block_size; // number and size of operator sets
+        const double *op_data; // stiffness and lifting matrices of every operator set
+        const unsigned int *cell_op_ids; // operator set of every cell
+        const double *cell_op_scales; // operator scaling of every cell
+        const unsigned int *cell_faces; // 4 face indices of every cell
+        const unsigned int *face_owners; // owner cell of every face
+        const unsigned int *face_boundary_ids; // boundary id of every boundary face
+        const unsigned int *face_dof_ids, *face_dof_ids_neighbor; // dof ids of face dofs
+        const double *face_wind_normal, *face_abs_wind_normal; // of face dofs
+        std::array<unsigned int, 4> face_first_dof, face_dof_increment;
+};
+
+/**
+ * @class device_operator
+ * @brief Keeps the operators, face connectivity and solution registers of advection2D on a CUDA
+ * device and applies the operator there
+ * 
+ * upload() copies the data once. The solution registers then stay on the device for the whole time
+ * loop, and the stages of the Runge-Kutta schemes are done by apply() and add() on them, without
+ * any transfer except the boundary values and the coefficients. get_solution() copies a register
+ * back on request, e.g. for output.
+ * 
+ * apply() runs two kernels: one thread per face dof computes the Rusanov flux, then one thread
+ * block per cell, with a thread per cell dof, applies the stiffness and lifting matrices. The
+ * cell values and fluxes of a block are staged in shared memory before any output is written, so
+ * the output register can be the input or the third register.
+ * 
+ * The class is compiled from device_operator.cu with the cmake option ADVECTION_WITH_CUDA. Without
+ * it, available() is false and the other functions throw.
+ */
+class device_operator
+{
+        public:
+        static constexpr unsigned int n_registers = 2;
+        /// Register id of a missing third operand of apply()
+        static constexpr unsigned int no_register = n_registers;
+
+        device_operator();
+        ~device_operator();
+        device_operator(const device_operator&) = delete;
+        device_operator& operator=(const device_operator&) = delete;
+
+        static bool available();
+        void upload(const device_operator_data &data);
+        void set_solution(const unsigned int reg, const double *values);
+        void get_solution(const unsigned int reg, double *values) const;
+        void apply(const unsigned int in, const unsigned int out, const double a, const double b,
+                const double c, const unsigned int w,
+                const std::array<double, n_boundary_ids> &bc_values,
+                const std::array<bool, n_boundary_ids> &bc_extrapolations);
+        void add(const unsigned int u, const double factor, const unsigned int v);
+        void swap(const unsigned int reg0, const unsigned int reg1);
+
+        private:
+        struct device_data; // device pointers, see device_operator.cu
+        device_data *data = nullptr;
+};
+
+#endif
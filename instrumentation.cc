@@ -0,0 +1,174 @@
+/**
+ * @file instrumentation.cc
+ * @brief Defines instrumentation class
+ */
+
+#include "instrumentation.h"
+
+#include <fstream>
+#include <iomanip>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+std::array<instrumentation::clock::time_point, instrumentation::n_phases>
+        instrumentation::phase_starts;
+std::array<std::uint64_t, instrumentation::n_phases> instrumentation::phase_start_cycles;
+std::array<instrumentation::counters, instrumentation::n_phases> instrumentation::step_counters,
+        instrumentation::total_counters;
+instrumentation::clock::time_point instrumentation::origin, instrumentation::step_start;
+bool instrumentation::started = false;
+std::vector<instrumentation::event> instrumentation::trace;
+std::size_t instrumentation::n_events = 0;
+
+/// Names of the phases, in the order of instrumentation::phase
+static const std::array<const char*, instrumentation::n_phases> phase_names = {
+        "ghost exchange", "boundary fluxes", "internal fluxes", "hanging fluxes", "cells",
+        "vector update"
+};
+
+/**
+ * @brief Returns the time stamp counter, 0 where it is not available
+ */
+std::uint64_t instrumentation::cycles()
+{
+        #if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+        #else
+        return 0;
+        #endif
+}
+
+/**
+ * @brief Returns the microseconds from the first event to @p t
+ */
+double instrumentation::microseconds(const clock::time_point &t)
+{
+        return std::chrono::duration<double, std::micro>(t - origin).count();
+}
+
+/**
+ * @brief Starts phase @p p
+ * 
+ * The first call also starts the first step.
+ */
+void instrumentation::begin(const phase p)
+{
+        phase_starts[p] = clock::now();
+        phase_start_cycles[p] = cycles();
+        if(!started){
+                origin = step_start = phase_starts[p];
+                trace.resize(trace_capacity);
+                started = true;
+        }
+}
+
+/**
+ * @brief Ends phase @p p, started by begin(), adding @p items, @p bytes and @p flops to its
+ * counters of the step
+ */
+void instrumentation::end(const phase p, const double items, const double bytes,
+        const double flops)
+{
+        const std::uint64_t end_cycles = cycles();
+        const clock::time_point end_time = clock::now();
+        counters &c = step_counters[p];
+        c.seconds += std::chrono::duration<double>(end_time - phase_starts[p]).count();
+        c.cycles += end_cycles - phase_start_cycles[p];
+        c.items += items;
+        c.bytes += bytes;
+        c.flops += flops;
+        c.calls++;
+        add_event(event{p, 0, microseconds(phase_starts[p]),
+                microseconds(end_time) - microseconds(phase_starts[p]), items});
+}
+
+/**
+ * @brief Logs the counters of the phases of step @p step to <code>deallog</code>, adds them to
+ * the totals and starts the next step
+ */
+void instrumentation::end_step(const uint step)
+{
+        if(!started) return;
+        const clock::time_point end_time = clock::now();
+        add_event(event{-1, step, microseconds(step_start),
+                microseconds(end_time) - microseconds(step_start), 0});
+        step_start = end_time;
+
+        for(uint p=0; p<n_phases; p++){
+                if(step_counters[p].calls == 0) continue;
+                log_counters(phase_names[p], step_counters[p]);
+                total_counters[p].add(step_counters[p]);
+                step_counters[p] = counters();
+        }
+}
+
+/**
+ * @brief Logs the total counters of every phase to <code>deallog</code>
+ */
+void instrumentation::log_summary()
+{
+        deallog << "Phase totals" << std::endl;
+        for(uint p=0; p<n_phases; p++){
+                if(total_counters[p].calls > 0) log_counters(phase_names[p], total_counters[p]);
+        }
+}
+
+/**
+ * @brief Writes the events in the ring buffer to @p file_name in the Chrome trace event format
+ * 
+ * Every event is a complete ("X") event of process 0, with the phases on thread 1 and the steps
+ * on thread 0. Only the last instrumentation::trace_capacity events are kept.
+ */
+void instrumentation::write_trace(const std::string &file_name)
+{
+        std::ofstream file(file_name);
+        AssertThrow(file, ExcMessage("Cannot open trace file " + file_name));
+        file << std::setprecision(12) << "{\"traceEvents\":[";
+        const std::size_t n = std::min<std::size_t>(n_events, trace_capacity),
+                first = n_events - n;
+        for(std::size_t i=0; i<n; i++){
+                const event &e = trace[(first + i)%trace_capacity];
+                file << (i == 0 ? "\n" : ",\n") << "{\"name\":\"";
+                if(e.p < 0) file << "step " << e.step;
+                else file << phase_names[e.p];
+                file << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << (e.p < 0 ? 0 : 1) << ",\"ts\":" <<
+                        e.start << ",\"dur\":" << e.duration << ",\"args\":{\"items\":" <<
+                        e.items << "}}";
+        }
+        file << "\n]}\n";
+}
+
+/**
+ * @brief Adds @p other to these counters
+ */
+void instrumentation::counters::add(const counters &other)
+{
+        seconds += other.seconds;
+        items += other.items;
+        bytes += other.bytes;
+        flops += other.flops;
+        cycles += other.cycles;
+        calls += other.calls;
+}
+
+/**
+ * @brief Stores @p e in the ring buffer, overwriting the oldest event if it is full
+ */
+void instrumentation::add_event(const event &e)
+{
+        trace[n_events%trace_capacity] = e;
+        n_events++;
+}
+
+/**
+ * @brief Logs counters @p c of the phase @p name with the achieved bandwidth and GFLOP/s
+ */
+void instrumentation::log_counters(const char *name, const counters &c)
+{
+        const double seconds = std::max(c.seconds, 1e-12);
+        deallog << "  " << name << ": " << c.calls << " calls, " << c.items << " items, " <<
+                1e3*c.seconds << " ms, " << c.cycles << " cycles, " << 1e-9*c.bytes/seconds <<
+                " GB/s, " << 1e-9*c.flops/seconds << " GFLOP/s" << std::endl;
+}
@@ -0,0 +1,121 @@
+/**
+ * @file instrumentation.h
+ * @brief Defines instrumentation class and the INSTRUMENT_* macros
+ */
+
+#include <deal.II/base/logstream.h>
+#include <deal.II/base/exceptions.h>
+
+#include <array>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+#include "common.h"
+
+#ifndef instrumentation_h
+#define instrumentation_h
+
+/**
+ * @class instrumentation
+ * @brief Counters and trace of the phases of advection2D::apply_operator()
+ * 
+ * Every phase records its wall time, the TSC cycles where available, the number of faces or
+ * cells processed and the modelled memory traffic and flops. So the achieved bandwidth and
+ * GFLOP/s of every phase are reported per step by end_step() and in all by log_summary(). Every
+ * phase and step is also stored as an event in a ring buffer of the last
+ * instrumentation::trace_capacity events, which write_trace() dumps in the Chrome trace event
+ * format (viewable in chrome://tracing or Perfetto).
+ * 
+ * The phases are recorded around the parallel loops, from the calling thread only, so no
+ * synchronisation is needed. The recording is compiled in only with the macro
+ * ADVECTION_INSTRUMENT (cmake option ADVECTION_WITH_INSTRUMENTATION). Without it, the INSTRUMENT_*
+ * macros expand to nothing and their arguments are not evaluated, so there is no overhead.
+ */
+class instrumentation
+{
+        public:
+        /// Instrumented phases
+        enum phase
+        {
+                ghost_exchange, ///< wait for the ghost values of the face phase
+                boundary_fluxes, ///< fluxes of boundary faces
+                internal_fluxes, ///< fluxes of faces between cells of the same level
+                hanging_fluxes, ///< fluxes of hanging faces and their transfer to the coarse side
+                cells, ///< stiffness, lifting and solution update of all cells
+                vector_update, ///< vector operations of the time integrator
+                n_phases
+        };
+
+        static constexpr bool enabled();
+        static void begin(const phase p);
+        static void end(const phase p, const double items, const double bytes, const double flops);
+        static void end_step(const uint step);
+        static void log_summary();
+        static void write_trace(const std::string &file_name);
+
+        /// Max number of events kept for write_trace()
+        static constexpr uint trace_capacity = 1u << 16;
+
+        private:
+        using clock = std::chrono::steady_clock;
+
+        /// Totals of a phase
+        struct counters
+        {
+                double seconds = 0, items = 0, bytes = 0, flops = 0;
+                std::uint64_t cycles = 0, calls = 0;
+                void add(const counters &other);
+        };
+        /// A phase or step in the trace
+        struct event
+        {
+                int p; // phase, or -1 for a step
+                uint step;
+                double start, duration; // in microseconds since the first event
+                double items;
+        };
+
+        static std::uint64_t cycles();
+        static double microseconds(const clock::time_point &t);
+        static void add_event(const event &e);
+        static void log_counters(const char *name, const counters &c);
+
+        static std::array<clock::time_point, n_phases> phase_starts;
+        static std::array<std::uint64_t, n_phases> phase_start_cycles;
+        static std::array<counters, n_phases> step_counters, total_counters;
+        static clock::time_point origin, step_start; // times of the first event and step start
+        static bool started;
+        static std::vector<event> trace; // ring buffer
+        static std::size_t n_events; // number of events recorded, trace holds the last ones
+};
+
+/**
+ * @brief Returns whether the recording is compiled in, see ADVECTION_INSTRUMENT
+ */
+constexpr bool instrumentation::enabled()
+{
+        #ifdef ADVECTION_INSTRUMENT
+        return true;
+        #else
+        return false;
+        #endif
+}
+
+#ifdef ADVECTION_INSTRUMENT
+/// Starts phase @p p, see instrumentation::begin()
+#define INSTRUMENT_BEGIN(p) instrumentation::begin(instrumentation::p)
+/// Ends phase @p p with @p items processed, @p bytes moved and @p flops done
+#define INSTRUMENT_END(p, items, bytes, flops) \
+        instrumentation::end(instrumentation::p, items, bytes, flops)
+/// Ends the step @p step, see instrumentation::end_step()
+#define INSTRUMENT_END_STEP(step) instrumentation::end_step(step)
+#else
+#define INSTRUMENT_BEGIN(p) ((void)0)
+#define INSTRUMENT_END(p, items, bytes, flops) ((void)0)
+#define INSTRUMENT_END_STEP(step) ((void)0)
+#endif
+
+#endif
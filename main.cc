@@ -1,6 +1,10 @@
 /**
  * @file main.cc
  * @brief The main file of the project
+ *
+ * Usage: <code>advection2D [parameter file]</code>. The parameters are described in
+ * advection2D::declare_parameters(). Without a parameter file, advection2D::test() is run in debug
+ * builds and the default parameters are used in release builds.
  */
 
 #include "advection2D.h"
@@ -8,13 +12,27 @@
 #include <iostream>
 #include <fstream>
 
-int main()
+int main(int argc, char *argv[])
 {
-        deallog.depth_console(2);
+        // threads are left to TBB, see advection2D::set_n_threads()
+        Utilities::MPI::MPI_InitFinalize mpi_init(argc, argv, numbers::invalid_unsigned_int);
+        const bool is_root = Utilities::MPI::this_mpi_process(MPI_COMM_WORLD) == 0;
+        if(is_root) deallog.depth_console(2);
+        else deallog.depth_console(0);
 
-        printf("Hello World!\n");
-        #ifdef DEBUG
-        advection2D::test();
-        #endif
+        ParameterHandler prm;
+        advection2D::declare_parameters(prm);
+        if(argc > 1) prm.parse_input(argv[1]);
+        else{
+                #ifdef DEBUG
+                advection2D::test();
+                return 0;
+                #endif
+                if(is_root){
+                        std::cout << "No parameter file given, using defaults:" << std::endl;
+                        prm.print_parameters(std::cout, ParameterHandler::Text);
+                }
+        }
+        advection2D::run(prm);
         return 0;
-}
\ No newline at end of file
+}
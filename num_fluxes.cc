@@ -31,4 +31,55 @@ double rusanov_flux(const double o_state, const double n_state,
         const double num_visc = fabs(wind(loc)*normal); // artificial or numerical viscosity
         return 0.5*( exact_flux(o_state, loc) + exact_flux(n_state, loc) ) * normal +
                0.5*num_visc*(o_state - n_state);
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Calculates Rusanov numerical flux using precomputed wind normal products
+ * @param[in] o_state The owner state
+ * @param[in] n_state The neighbour state
+ * @param[in] wind_normal Wind dotted with the face normal at the quad point
+ * @param[in] abs_wind_normal Absolute value of @p wind_normal
+ *
+ * Since the exact flux is linear in state, the normal flux is simply the state times
+ * @p wind_normal. This version avoids evaluating wind and is used with the face geometry cache of
+ * advection2D
+ * @warning The normal used must be a unit vector and must point from owner to neighbor
+ */
+double rusanov_flux(const double o_state, const double n_state,
+                         const double wind_normal, const double abs_wind_normal)
+{
+        return 0.5*(o_state + n_state)*wind_normal + 0.5*abs_wind_normal*(o_state - n_state);
+}
+
+/**
+ * @brief Calculates Rusanov numerical fluxes of @p n_nodes face nodes at once
+ * @param[in] n_nodes The number of nodes
+ * @param[in] o_states The owner states
+ * @param[in] n_states The neighbour states
+ * @param[in] wind_normal Wind dotted with the face normal at the nodes
+ * @param[in] abs_wind_normal Absolute values of @p wind_normal
+ * @param[out] fluxes The normal numerical fluxes
+ *
+ * All arrays have @p n_nodes entries and need not be aligned. The nodes are processed in batches of
+ * <code>VectorizedArray<double>::n_array_elements</code>, whose width (SSE2, AVX2 or AVX-512) is
+ * set by the instruction set deal.II is compiled for. The remaining nodes use the scalar version.
+ */
+void rusanov_flux(const uint n_nodes, const double *o_states, const double *n_states,
+                  const double *wind_normal, const double *abs_wind_normal, double *fluxes)
+{
+        constexpr uint width = VectorizedArray<double>::n_array_elements;
+        VectorizedArray<double> o_state, n_state, wn, abs_wn;
+        uint i;
+        for(i=0; i+width<=n_nodes; i+=width){
+                o_state.load(o_states + i);
+                n_state.load(n_states + i);
+                wn.load(wind_normal + i);
+                abs_wn.load(abs_wind_normal + i);
+                const VectorizedArray<double> flux = 0.5*((o_state + n_state)*wn +
+                        abs_wn*(o_state - n_state));
+                flux.store(fluxes + i);
+        } // loop over batches
+        for(; i<n_nodes; i++){
+                fluxes[i] = rusanov_flux(o_states[i], n_states[i], wind_normal[i], abs_wind_normal[i]);
+        }
+}
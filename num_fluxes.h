@@ -4,6 +4,7 @@
  */
 
 #include <deal.II/base/point.h>
+#include <deal.II/base/vectorization.h>
 
 #include "common.h"
 #include "wind.h"
@@ -14,5 +15,9 @@
 Tensor<1,2> exact_flux(const double s_value, const Point<2> &loc);
 double rusanov_flux(const double o_state, const double n_state, 
                          const Point<2> &loc, const Tensor<1,2> &normal);
+double rusanov_flux(const double o_state, const double n_state,
+                         const double wind_normal, const double abs_wind_normal);
+void rusanov_flux(const uint n_nodes, const double *o_states, const double *n_states,
+                  const double *wind_normal, const double *abs_wind_normal, double *fluxes);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,158 @@
+/**
+ * @file output_writer.cc
+ * @brief Defines output_writer class
+ */
+
+#include "output_writer.h"
+
+#include <fstream>
+
+/**
+ * @brief Constructor with the @p dof_handler of the solution, the communicator @p mpi_comm and
+ * max number of snapshots in flight @p max_in_flight as args
+ *
+ * The background thread is started here. The rank and number of processes are computed here so
+ * that no MPI call is made from the background thread.
+ */
+output_writer::output_writer(const DoFHandler<2> &dof_handler, const MPI_Comm &mpi_comm,
+        const uint max_in_flight)
+: dof_handler(dof_handler), rank(Utilities::MPI::this_mpi_process(mpi_comm)),
+        n_processes(Utilities::MPI::n_mpi_processes(mpi_comm)),
+        max_in_flight(std::max(max_in_flight, 1u)), n_in_flight(0), stop(false),
+        writer_thread(&output_writer::run, this)
+{}
+
+/**
+ * @brief Destructor, writes all pending snapshots and joins the background thread
+ */
+output_writer::~output_writer()
+{
+        {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+        }
+        queue_cv.notify_one();
+        writer_thread.join();
+}
+
+/**
+ * @brief Queues a copy of @p solution at @p time to be written with @p base_name and @p counter
+ *
+ * See output_writer for the file names.
+ * Waits if output_writer::max_in_flight snapshots are already in flight. Exceptions thrown while
+ * writing earlier snapshots are rethrown here.
+ */
+void output_writer::write(const LinearAlgebra::distributed::Vector<double> &solution,
+        const std::string &base_name, const uint counter, const double time)
+{
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]{ return n_in_flight < max_in_flight || error; });
+        if(error) std::rethrow_exception(error);
+        n_in_flight++;
+        lock.unlock();
+
+        // copy without the lock, the background thread does not need it
+        snapshot cur_snapshot;
+        cur_snapshot.solution = solution;
+        cur_snapshot.base_name = base_name;
+        cur_snapshot.counter = counter;
+        cur_snapshot.time = time;
+
+        lock.lock();
+        queue.emplace_back(std::move(cur_snapshot));
+        lock.unlock();
+        queue_cv.notify_one();
+}
+
+/**
+ * @brief Waits till all the queued snapshots are written
+ *
+ * Exceptions thrown while writing are rethrown here.
+ */
+void output_writer::flush()
+{
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]{ return n_in_flight == 0; });
+        if(error) std::rethrow_exception(error);
+}
+
+/**
+ * @brief Loop of the background thread, writes snapshots in the order they are queued
+ *
+ * Exits when output_writer::stop is set and the queue is empty. After an exception, the remaining
+ * snapshots are discarded.
+ */
+void output_writer::run()
+{
+        std::unique_lock<std::mutex> lock(mutex);
+        while(true){
+                queue_cv.wait(lock, [this]{ return stop || !queue.empty(); });
+                if(queue.empty()) return; // stop requested
+
+                snapshot cur_snapshot = std::move(queue.front());
+                queue.pop_front();
+                lock.unlock();
+                try{
+                        if(!error) write_snapshot(cur_snapshot);
+                }
+                catch(...){
+                        std::lock_guard<std::mutex> error_lock(mutex);
+                        if(!error) error = std::current_exception();
+                }
+                lock.lock();
+                n_in_flight--;
+                done_cv.notify_all();
+        }
+}
+
+/**
+ * @brief Builds patches and writes @p cur_snapshot in compressed vtu format, along with the pvtu
+ * and pvd records on the root process
+ *
+ * With <code>VtkFlags::write_higher_order_cells</code>, the patches are built with as many
+ * subdivisions as the degree, so that every patch is written as a single Lagrange cell. The pvtu
+ * and pvd records refer to the other files without the directory of @p base_name, since they are
+ * placed in the same directory.
+ */
+void output_writer::write_snapshot(const snapshot &cur_snapshot)
+{
+        DataOut<2> data_out;
+        data_out.attach_dof_handler(dof_handler);
+        data_out.add_data_vector(cur_snapshot.solution, "phi");
+
+        data_out.build_patches(dof_handler.get_fe().degree);
+
+        DataOutBase::VtkFlags flags;
+        flags.time = cur_snapshot.time;
+        flags.cycle = cur_snapshot.counter;
+        flags.compression_level = DataOutBase::VtkFlags::ZlibCompressionLevel::best_speed;
+        flags.write_higher_order_cells = true;
+        data_out.set_flags(flags);
+
+        const std::string &base_name = cur_snapshot.base_name;
+        const std::string local_name = base_name.substr(base_name.find_last_of('/') + 1);
+        const std::string counter_name = "." + Utilities::int_to_string(cur_snapshot.counter, 5);
+        std::string piece_name = counter_name;
+        if(n_processes > 1) piece_name += "." + Utilities::int_to_string(rank, 4);
+        piece_name += ".vtu";
+        std::ofstream ofile(base_name + piece_name);
+        data_out.write_vtu(ofile);
+
+        if(rank != 0) return;
+        std::string record_name = local_name + piece_name;
+        if(n_processes > 1){
+                std::vector<std::string> piece_names;
+                for(uint i=0; i<n_processes; i++){
+                        piece_names.emplace_back(local_name + counter_name + "." +
+                                Utilities::int_to_string(i, 4) + ".vtu");
+                }
+                record_name = local_name + counter_name + ".pvtu";
+                std::ofstream pvtu_file(base_name + counter_name + ".pvtu");
+                data_out.write_pvtu_record(pvtu_file, piece_names);
+        }
+
+        std::vector<std::pair<double, std::string>> &records = pvd_records[base_name];
+        records.emplace_back(cur_snapshot.time, record_name);
+        std::ofstream pvd_file(base_name + ".pvd");
+        DataOutBase::write_pvd_record(pvd_file, records);
+}
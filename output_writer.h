@@ -0,0 +1,89 @@
+/**
+ * @file output_writer.h
+ * @brief Defines output_writer class
+ */
+
+#include <deal.II/base/mpi.h>
+#include <deal.II/base/utilities.h>
+#include <deal.II/dofs/dof_handler.h>
+#include <deal.II/lac/la_parallel_vector.h>
+#include <deal.II/numerics/data_out.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+#include "common.h"
+
+#ifndef output_writer_h
+#define output_writer_h
+
+/**
+ * @class output_writer
+ * @brief Writes the solution in a background thread
+ *
+ * write() copies the solution into a snapshot and queues it, and a background thread builds the
+ * patches and writes the file. So the time loop blocks only for the copy. To cap the memory, at
+ * most output_writer::max_in_flight snapshots are queued or being written at a time and write()
+ * waits for a free slot beyond that.
+ *
+ * The output is zlib compressed binary vtu. Every cell is a single higher order Lagrange cell of
+ * the degree of the finite element, instead of being subdivided into linear patches. For base name
+ * @p base and counter @p n, the file written is @p base.n.vtu. With more than one MPI process,
+ * every process writes its owned cells to @p base.n.rank.vtu and the root process writes the
+ * parallel record @p base.n.pvtu listing them. The root process also keeps the time series index
+ * @p base.pvd updated after every write. Here @p n and @p rank are zero padded to 5 and 4 digits.
+ *
+ * The background thread reads the mesh and dofs through output_writer::dof_handler. So the mesh
+ * must not be changed while snapshots are in flight, call flush() before that.
+ */
+class output_writer
+{
+        public:
+        output_writer(const DoFHandler<2> &dof_handler, const MPI_Comm &mpi_comm,
+                const uint max_in_flight = 2);
+        ~output_writer();
+
+        void write(const LinearAlgebra::distributed::Vector<double> &solution,
+                const std::string &base_name, const uint counter, const double time);
+        void flush();
+
+        private:
+        /**
+         * @brief A queued solution copy and where it is to be written
+         */
+        struct snapshot
+        {
+                LinearAlgebra::distributed::Vector<double> solution;
+                std::string base_name;
+                uint counter;
+                double time;
+        };
+
+        void run();
+        void write_snapshot(const snapshot &cur_snapshot);
+
+        const DoFHandler<2> &dof_handler;
+        const uint rank, n_processes; // computed once, no MPI calls from background thread
+        const uint max_in_flight; // max snapshots queued or being written
+        // time and file name (vtu or pvtu) of every written snapshot, by base name. Only used by
+        // the background thread of the root process
+        std::map<std::string, std::vector<std::pair<double, std::string>>> pvd_records;
+
+        std::deque<snapshot> queue; // snapshots yet to be written
+        uint n_in_flight; // queued snapshots plus the one being written
+        bool stop; // signals the background thread to exit once the queue is empty
+        std::exception_ptr error; // first exception thrown in background thread
+        std::mutex mutex; // guards all the above
+        std::condition_variable queue_cv; // notified when a snapshot is queued or on stop
+        std::condition_variable done_cv; // notified when a snapshot is written
+        std::thread writer_thread;
+};
+
+#endif
@@ -0,0 +1,207 @@
+/**
+ * @file sum_factorization.cc
+ * @brief Defines sum_factorization class
+ */
+
+#include "sum_factorization.h"
+
+/**
+ * @brief Constructor with @p degree of polynomial approx as arg
+ *
+ * The 1D basis is obtained from <code>FE_DGQ<1></code> of the same degree, so that the dof
+ * ordering and support points are consistent with <code>FE_DGQ<2></code>. The 1D mass matrix is
+ * computed with sum_factorization::quad and inverted here.
+ */
+sum_factorization::sum_factorization(const uint degree)
+: n(degree+1), quad(degree+1)
+{
+        FE_DGQ<1> fe_1d(degree);
+        uint a, b, q;
+        B.resize(n*n);
+        std::vector<double> G(n*n);
+        for(q=0; q<n; q++){
+                for(a=0; a<n; a++){
+                        B[q*n + a] = fe_1d.shape_value(a, quad.point(q));
+                        G[q*n + a] = fe_1d.shape_grad(a, quad.point(q))[0];
+                }
+        }
+
+        FullMatrix<double> mass(n), mass_inv(n);
+        mass = 0;
+        for(a=0; a<n; a++){
+                for(b=0; b<n; b++){
+                        for(q=0; q<n; q++) mass(a,b) += B[q*n + a]*B[q*n + b]*quad.weight(q);
+                }
+        }
+        mass_inv.invert(mass);
+
+        D1.assign(n*n, 0);
+        Bt.assign(n*n, 0);
+        for(a=0; a<n; a++){
+                for(q=0; q<n; q++){
+                        for(b=0; b<n; b++){
+                                D1[a*n + q] += mass_inv(a,b)*G[q*n + b];
+                                Bt[a*n + q] += mass_inv(a,b)*B[q*n + b];
+                        }
+                }
+        }
+
+        // dof 0 is at xi=0 and dof degree is at xi=1
+        for(uint side=0; side<2; side++){
+                end_mass_inv[side].resize(n);
+                for(a=0; a<n; a++) end_mass_inv[side][a] = mass_inv(a, side*degree);
+        }
+}
+
+/**
+ * @brief Returns the size of work array required by apply_stiffness() and interpolate()
+ */
+uint sum_factorization::n_work() const
+{
+        return 4*n*n;
+}
+
+/**
+ * @brief Computes the values of a cell at its quad points, @f$[B\otimes B]\{\phi\}@f$
+ *
+ * @param[in] phi Cell dof values
+ * @param[out] values Values at cell quad points, quad point @f$q_1 + (N+1)q_2@f$ at that index
+ * @param work Work array of size @f$(N+1)^2@f$
+ *
+ * @tparam n_1d See apply_stiffness()
+ * @tparam Number See apply_stiffness()
+ */
+template <int n_1d, typename Number>
+void sum_factorization::interpolate(const Number *phi, Number *values, Number *work) const
+{
+        const uint n = (n_1d > 0) ? n_1d : this->n;
+        uint a, b, q1, q2;
+        Number sum;
+
+        // along x: work(q1,b)
+        for(b=0; b<n; b++){
+                for(q1=0; q1<n; q1++){
+                        sum = 0;
+                        for(a=0; a<n; a++) sum += B[q1*n + a]*phi[a + n*b];
+                        work[q1 + n*b] = sum;
+                }
+        }
+        // along y: values(q1,q2)
+        for(q2=0; q2<n; q2++){
+                for(q1=0; q1<n; q1++){
+                        sum = 0;
+                        for(b=0; b<n; b++) sum += B[q2*n + b]*work[q1 + n*b];
+                        values[q1 + n*q2] = sum;
+                }
+        }
+}
+
+/**
+ * @brief Adds the stiffness term of a cell to @p rhs
+ *
+ * @param[in] phi Cell dof values
+ * @param[in] c_x The coefficients @f$c_x@f$ at cell quad points, see sum_factorization
+ * @param[in] c_y The coefficients @f$c_y@f$ at cell quad points
+ * @param[in,out] rhs The cell rhs to which the stiffness term is added
+ * @param work Work array of size n_work()
+ *
+ * @tparam n_1d Number of 1D dofs if known at compile time, else 0
+ * @tparam Number <code>double</code> for a single cell or <code>VectorizedArray<double></code> for
+ * a batch of cells, with the data of the cells interleaved in the lanes
+ */
+template <int n_1d, typename Number>
+void sum_factorization::apply_stiffness(const Number *phi, const Number *c_x, const Number *c_y,
+        Number *rhs, Number *work) const
+{
+        const uint n = (n_1d > 0) ? n_1d : this->n;
+        Number *temp = work, *values = work + n*n, *res_x = work + 2*n*n, *res_y = work + 3*n*n;
+        uint a, b, q1, q2;
+        Number sum, sum_x, sum_y, cur_value;
+
+        interpolate<n_1d>(phi, values, temp);
+
+        // multiply by coefficients and test along y
+        for(b=0; b<n; b++){
+                for(q1=0; q1<n; q1++){
+                        sum_x = 0;
+                        sum_y = 0;
+                        for(q2=0; q2<n; q2++){
+                                cur_value = values[q1 + n*q2];
+                                sum_x += Bt[b*n + q2]*c_x[q1 + n*q2]*cur_value;
+                                sum_y += D1[b*n + q2]*c_y[q1 + n*q2]*cur_value;
+                        }
+                        res_x[q1 + n*b] = sum_x;
+                        res_y[q1 + n*b] = sum_y;
+                }
+        }
+        // test along x
+        for(b=0; b<n; b++){
+                for(a=0; a<n; a++){
+                        sum = 0;
+                        for(q1=0; q1<n; q1++){
+                                sum += D1[a*n + q1]*res_x[q1 + n*b] + Bt[a*n + q1]*res_y[q1 + n*b];
+                        }
+                        rhs[a + n*b] += sum;
+                }
+        }
+}
+
+/**
+ * @brief Adds the lifting term of a face to @p rhs
+ *
+ * @param[in] face_id Face id wrt the cell
+ * @param[in] face_values The (negative) normal numerical flux at face dofs, ordered as face dofs
+ * (see advection2D::face_first_dof)
+ * @param[in] inv_size @f$1/h_x@f$ for faces 0 and 1, @f$1/h_y@f$ for faces 2 and 3
+ * @param[in,out] rhs The cell rhs
+ *
+ * @tparam n_1d Number of 1D dofs if known at compile time, else 0
+ * @tparam Number See apply_stiffness()
+ */
+template <int n_1d, typename Number>
+void sum_factorization::apply_lifting(const uint face_id, const Number *face_values,
+        const Number inv_size, Number *rhs) const
+{
+        const uint n = (n_1d > 0) ? n_1d : this->n;
+        const double *end_col = end_mass_inv[face_id%2].data();
+        uint a, b;
+        if(face_id < 2){
+                // face normal along x: face dof b is cell dof (0 or N) + n*b
+                for(b=0; b<n; b++){
+                        const Number cur_value = inv_size*face_values[b];
+                        for(a=0; a<n; a++) rhs[a + n*b] += end_col[a]*cur_value;
+                }
+        }
+        else{
+                // face normal along y: face dof a is cell dof a + (0 or N)*n
+                for(b=0; b<n; b++){
+                        const Number cur_value = inv_size*end_col[b];
+                        for(a=0; a<n; a++) rhs[a + n*b] += cur_value*face_values[a];
+                }
+        }
+}
+
+
+
+// explicit instantiations, runtime size and degrees 1 to 8, for single cells and cell batches
+#define SF_INSTANTIATE_NUMBER(N_1D, NUMBER) \
+template void sum_factorization::interpolate<N_1D, NUMBER>(const NUMBER*, NUMBER*, NUMBER*) \
+        const; \
+template void sum_factorization::apply_stiffness<N_1D, NUMBER>(const NUMBER*, const NUMBER*, \
+        const NUMBER*, NUMBER*, NUMBER*) const; \
+template void sum_factorization::apply_lifting<N_1D, NUMBER>(const uint, const NUMBER*, \
+        const NUMBER, NUMBER*) const;
+#define SF_INSTANTIATE(N_1D) \
+SF_INSTANTIATE_NUMBER(N_1D, double) \
+SF_INSTANTIATE_NUMBER(N_1D, VectorizedArray<double>)
+SF_INSTANTIATE(0)
+SF_INSTANTIATE(2)
+SF_INSTANTIATE(3)
+SF_INSTANTIATE(4)
+SF_INSTANTIATE(5)
+SF_INSTANTIATE(6)
+SF_INSTANTIATE(7)
+SF_INSTANTIATE(8)
+SF_INSTANTIATE(9)
+#undef SF_INSTANTIATE
+#undef SF_INSTANTIATE_NUMBER
@@ -0,0 +1,77 @@
+/**
+ * @file sum_factorization.h
+ * @brief Defines sum_factorization class
+ */
+
+#include <deal.II/base/quadrature_lib.h>
+#include <deal.II/base/vectorization.h>
+#include <deal.II/lac/full_matrix.h>
+#include <deal.II/fe/fe_dgq.h>
+
+#include <vector>
+#include <array>
+
+#include "common.h"
+
+#ifndef sum_factorization_h
+#define sum_factorization_h
+
+/**
+ * @class sum_factorization
+ * @brief 1D matrices and kernels for matrix-free application of stiffness and lifting operators
+ * on axis aligned rectangular cells
+ *
+ * The basis of <code>FE_DGQ<2></code> is a tensor product of 1D Lagrange polynomials @f$l_a@f$,
+ * with cell dof @f$a + (N+1)b@f$ having the basis @f$l_a(\xi)l_b(\eta)@f$. On a cell of size
+ * @f$h_x \times h_y@f$ the mass matrix is @f$h_xh_y [M_1]\otimes[M_1]@f$, where @f$[M_1]@f$ is the
+ * reference 1D mass matrix. With @f$(N+1)@f$ point Gauss quadrature, the stiffness term is
+ * @f[
+ * [S]\{\phi\} = \left([D_1]\otimes[B_t]\right)\left(c_x\circ[B\otimes B]\{\phi\}\right) +
+ * \left([B_t]\otimes[D_1]\right)\left(c_y\circ[B\otimes B]\{\phi\}\right)
+ * @f]
+ * where @f$B_{qa} = l_a(\xi_q)@f$, @f$G_{qa} = l'_a(\xi_q)@f$, @f$[D_1] = [M_1]^{-1}[G]^T@f$ and
+ * @f$[B_t] = [M_1]^{-1}[B]^T@f$. The first factor of a tensor product acts along @f$x@f$. The
+ * coefficients at quadrature point @f$q = q_1 + (N+1)q_2@f$ are
+ * @f$c_x = v_x w_{q_1}w_{q_2}/h_x@f$ and @f$c_y = v_y w_{q_1}w_{q_2}/h_y@f$, where @f$\vec{v}@f$
+ * is the wind. Every tensor product is applied as two 1D passes, giving @f$O(N^3)@f$ cost instead of
+ * @f$O(N^4)@f$ for a dense matrix.
+ *
+ * Since the Lagrange basis is nodal at cell ends, the flux matrix of face 0 is
+ * @f$h_y (e_0e_0^T)\otimes[M_1]@f$. So the lifting term of face 0 reduces to
+ * @f$\frac{1}{h_x}([M_1]^{-1}e_0)\otimes\{f^*\}@f$, which involves only the face dofs. The other
+ * faces are similar. See apply_lifting()
+ *
+ * The kernels are templated on the number of 1D dofs @p n_1d, so that the loop trip counts are
+ * known at compile time. They are instantiated for @p n_1d from 2 to 9 (degrees 1 to 8), and
+ * @p n_1d = 0 uses sum_factorization::n at runtime for any degree. They are also instantiated for
+ * <code>VectorizedArray<double></code>, which applies the same 1D matrices to a batch of cells at
+ * once.
+ */
+class sum_factorization
+{
+        public:
+        sum_factorization(const uint degree);
+
+        uint n_work() const;
+        template <int n_1d = 0, typename Number = double>
+        void interpolate(const Number *phi, Number *values, Number *work) const;
+        template <int n_1d = 0, typename Number = double>
+        void apply_stiffness(const Number *phi, const Number *c_x, const Number *c_y, Number *rhs,
+                Number *work) const;
+        template <int n_1d = 0, typename Number = double>
+        void apply_lifting(const uint face_id, const Number *face_values, const Number inv_size,
+                Number *rhs) const;
+
+        const uint n; // number of 1D dofs = number of 1D quad points
+        QGauss<1> quad; // 1D quadrature
+
+        private:
+        // 1D matrices, all row major
+        std::vector<double> B; // basis values at quad points (quad point x dof)
+        std::vector<double> D1; // mass inverse times transpose of basis derivatives (dof x quad point)
+        std::vector<double> Bt; // mass inverse times transpose of basis values (dof x quad point)
+        // columns of 1D mass inverse corresponding to dofs at xi=0 and xi=1
+        std::array<std::vector<double>, 2> end_mass_inv;
+};
+
+#endif
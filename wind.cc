@@ -15,4 +15,15 @@ const Tensor<1,2> wind(const Point<2> &p)
         wind_value[1] = 1.0;
         wind_value /= wind_value.norm();
         return wind_value;
-}
\ No newline at end of file
+}
+/**
+ * @brief Returns the wind at point @p p and time @p t
+ */
+Tensor<1,2> wind_field::operator()(const Point<2> &p, const double t) const
+{
+        switch(dependence){
+                case wind_dependence::separable: return time_factor(t)*shape(p);
+                case wind_dependence::general: return velocity(p, t);
+                default: return shape(p);
+        }
+}
@@ -6,6 +6,8 @@
 // #include <deal.II/base/tensor.h> // not reqd if point.h is included
 #include <deal.II/base/point.h>
 
+#include <functional>
+
 #include "common.h"
 
 #ifndef wind_h
@@ -13,4 +15,34 @@
 
 const Tensor<1,2> wind(const Point<2> &p);
 
-#endif
\ No newline at end of file
+/**
+ * @brief Dependence of a wind_field on time
+ */
+enum class wind_dependence
+{
+        steady, ///< @f$\vec{v}(\vec{x})@f$
+        separable, ///< @f$\vec{v}(\vec{x},t) = a(t)\vec{v}_0(\vec{x})@f$ with @f$a(t) \ge 0@f$
+        general ///< any @f$\vec{v}(\vec{x},t)@f$
+};
+
+/**
+ * @brief An advecting wind, with the declared dependence on time deciding what advection2D can
+ * reuse from assembly, see advection2D::set_wind()
+ * 
+ * wind_field::shape is the wind of a steady field and @f$\vec{v}_0@f$ of a separable one, with
+ * the factor @f$a(t)@f$ given by wind_field::time_factor. A general field is given by
+ * wind_field::velocity. The factor of a separable field must be non-negative, so that the upwind
+ * side of faces does not change with time. A wind which reverses has to be declared general.
+ * The default is the steady wind().
+ */
+struct wind_field
+{
+        wind_dependence dependence = wind_dependence::steady;
+        std::function<Tensor<1,2>(const Point<2>&)> shape = wind; // steady and separable
+        std::function<double(const double)> time_factor; // separable only
+        std::function<Tensor<1,2>(const Point<2>&, const double)> velocity; // general only
+
+        Tensor<1,2> operator()(const Point<2> &p, const double t) const;
+};
+
+#endif